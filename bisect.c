@@ -0,0 +1,268 @@
+/****************************************************************************
+ * pfw/bisect.c
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.  The
+ * ASF licenses this file to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ ****************************************************************************/
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include "internal.h"
+#include <stdlib.h>
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+/**
+ * @brief pfw_bisect_span_t is a set of states selecting the same config,
+ * from start to the start of the next span.
+ */
+typedef struct pfw_bisect_span_s {
+    int32_t start;
+    int config; // Index of config, -1 if none matches.
+} pfw_bisect_span_t;
+
+/**
+ * @brief pfw_bisect_t maps the state of the only criterion a domain
+ * tests by intervals to its winning config.
+ */
+struct pfw_bisect_s {
+    pfw_criterion_t* criterion;
+    int nb;
+    pfw_bisect_span_t spans[];
+};
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static inline bool pfw_bisect_true(pfw_rule_t* rule)
+{
+    return !rule
+        || ((rule->predicate == PFW_PREDICATE_ALL
+                || rule->predicate == PFW_PREDICATE_ANY)
+            && pfw_vector_count(rule->branches) == 0);
+}
+
+/**
+ * @brief Whether rule is In/NotIn on criterion, or ANY of them.
+ */
+static bool pfw_bisect_pure(pfw_rule_t* rule, pfw_criterion_t** criterion)
+{
+    pfw_rule_t* sub;
+    int i;
+
+    switch (rule->predicate) {
+    case PFW_PREDICATE_ANY:
+        for (i = 0; (sub = pfw_vector_get(rule->branches, i)); i++) {
+            if (sub->predicate == PFW_PREDICATE_ANY
+                || !pfw_bisect_pure(sub, criterion))
+                return false;
+        }
+
+        return i > 0;
+
+    case PFW_PREDICATE_IN:
+    case PFW_PREDICATE_NOTIN:
+        if (*criterion && *criterion != rule->criterion.p)
+            return false;
+
+        *criterion = rule->criterion.p;
+        return rule->criterion.p->type == PFW_CRITERION_NUMERICAL;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Append the bounds where the result of rule can change.
+ */
+static void pfw_bisect_bounds(pfw_rule_t* rule, int64_t* bounds, int* nb)
+{
+    pfw_rule_t* sub;
+    int i;
+
+    if (rule->predicate == PFW_PREDICATE_ANY) {
+        for (i = 0; (sub = pfw_vector_get(rule->branches, i)); i++)
+            pfw_bisect_bounds(sub, bounds, nb);
+
+        return;
+    }
+
+    bounds[(*nb)++] = rule->state.itv->left;
+    bounds[(*nb)++] = (int64_t)rule->state.itv->right + 1;
+}
+
+static int pfw_bisect_count(pfw_rule_t* rule)
+{
+    return rule->predicate == PFW_PREDICATE_ANY
+        ? 2 * pfw_vector_count(rule->branches)
+        : 2;
+}
+
+static int pfw_bisect_compare(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Same as pfw_rule_match() on a pure rule, with state s.
+ */
+static bool pfw_bisect_match(pfw_rule_t* rule, int32_t s)
+{
+    pfw_rule_t* sub;
+    bool in;
+    int i;
+
+    if (rule->predicate == PFW_PREDICATE_ANY) {
+        for (i = 0; (sub = pfw_vector_get(rule->branches, i)); i++) {
+            if (pfw_bisect_match(sub, s))
+                return true;
+        }
+
+        return false;
+    }
+
+    in = s >= rule->state.itv->left && s <= rule->state.itv->right;
+    return rule->predicate == PFW_PREDICATE_IN ? in : !in;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * @brief Build interval index for domain whose configs only test one
+ * NumericalCriterion by intervals, up to a catch-all config.
+ * @return false only if out of memory.
+ */
+bool pfw_bisect_build(pfw_domain_t* domain)
+{
+    pfw_criterion_t* criterion = NULL;
+    pfw_bisect_t* bisect;
+    pfw_config_t* config;
+    int64_t* bounds;
+    int i, j, nb = 1, last;
+
+    /* Only configs before the catch-all can be selected. */
+
+    for (last = 0; (config = pfw_vector_get(domain->configs, last)); last++) {
+        if (pfw_bisect_true(config->rules))
+            break;
+
+        if (!pfw_bisect_pure(config->rules, &criterion))
+            return true;
+
+        nb += pfw_bisect_count(config->rules);
+    }
+
+    if (!criterion)
+        return true;
+
+    bounds = malloc(nb * sizeof(int64_t));
+    if (!bounds)
+        return false;
+
+    bounds[0] = INT32_MIN;
+    for (i = 0, nb = 1; i < last; i++) {
+        config = pfw_vector_get(domain->configs, i);
+        pfw_bisect_bounds(config->rules, bounds, &nb);
+    }
+
+    qsort(bounds, nb, sizeof(int64_t), pfw_bisect_compare);
+
+    bisect = malloc(sizeof(pfw_bisect_t) + nb * sizeof(pfw_bisect_span_t));
+    if (!bisect) {
+        free(bounds);
+        return false;
+    }
+
+    bisect->criterion = criterion;
+    bisect->nb = 0;
+    for (i = 0; i < nb; i++) {
+        if (bounds[i] > INT32_MAX || (i > 0 && bounds[i] == bounds[i - 1]))
+            continue;
+
+        for (j = 0; (config = pfw_vector_get(domain->configs, j)); j++) {
+            if (j == last || pfw_bisect_match(config->rules, bounds[i]))
+                break;
+        }
+
+        if (!config)
+            j = -1;
+
+        /* Merge with previous span selecting the same config. */
+
+        if (bisect->nb > 0 && bisect->spans[bisect->nb - 1].config == j)
+            continue;
+
+        bisect->spans[bisect->nb].start = bounds[i];
+        bisect->spans[bisect->nb].config = j;
+        bisect->nb++;
+    }
+
+    free(bounds);
+    domain->bisect = bisect;
+    return true;
+}
+
+/**
+ * @brief Mark reached[i + 1] for every config index i selected by a span,
+ * reached[0] for none.
+ *
+ * Every span counts, even out of the ranges of the criterion, since
+ * pfw_setstring() and on_load may set such states.
+ */
+void pfw_bisect_reach(pfw_bisect_t* bisect, bool* reached)
+{
+    int i;
+
+    for (i = 0; i < bisect->nb; i++)
+        reached[bisect->spans[i].config + 1] = true;
+}
+
+void pfw_bisect_free(pfw_bisect_t* bisect)
+{
+    free(bisect);
+}
+
+/**
+ * @brief Binary search the winning config index, -1 if none matches.
+ */
+int pfw_bisect_lookup(pfw_bisect_t* bisect)
+{
+    int32_t s = bisect->criterion->state;
+    int lo = 0, hi = bisect->nb - 1, mid;
+
+    /* Find the last span starting at or before s, spans[0] starts at
+     * INT32_MIN so it always exists.
+     */
+
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (bisect->spans[mid].start <= s)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    return bisect->spans[lo].config;
+}
@@ -0,0 +1,510 @@
+/****************************************************************************
+ * pfw/compiler.c
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.  The
+ * ASF licenses this file to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ ****************************************************************************/
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include "internal.h"
+#include <stdlib.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+/* Terminal program counters. */
+
+#define PFW_PC_TRUE -1
+#define PFW_PC_FALSE -2
+
+/* Opcode testing packed states, the others are PFW_PREDICATE_*. */
+
+#define PFW_OPCODE_MASK 64
+
+#define PFW_PACKED_BITS 64
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+/**
+ * @brief pfw_insn_t tests one leaf rule, or several leaves at once
+ * through packed states, then jumps.
+ *
+ * Branch nodes are lowered into the jump targets, so ALL and ANY
+ * short-circuit without recursion.
+ */
+typedef struct pfw_insn_s {
+    int opcode; // @see PFW_PREDICATE_* PFW_OPCODE_*
+    int t; // Next pc if test is true.
+    int f; // Next pc if test is false.
+    union {
+        struct {
+            const int32_t* state; // Criterion state, inlined.
+            int32_t left; // Operand, or left bound of interval.
+            int32_t right; // Right bound of interval.
+            int leaf; // Leaf number in sweep results.
+        } leaf;
+        pfw_condition_t* cond; // PFW_PREDICATE_COND.
+        struct {
+            const uint64_t* word; // Packed states.
+            uint64_t mask;
+            uint64_t expect; // True if (*word & mask) == expect.
+        } bits;
+    } u;
+} pfw_insn_t;
+
+struct pfw_program_s {
+    int entry;
+    int nb;
+    pfw_insn_t insns[];
+};
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+/**
+ * @brief Bits needed to pack criterion state, 0 if not packable.
+ */
+static int pfw_compile_width(pfw_criterion_t* criterion)
+{
+    int nb, width;
+
+    nb = pfw_vector_count(criterion->ranges);
+
+    switch (criterion->type) {
+    case PFW_CRITERION_INCLUSIVE:
+        return nb;
+
+    case PFW_CRITERION_EXCLUSIVE:
+        for (width = 0; (1 << width) < nb; width++)
+            ;
+
+        return width;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Lay out Exclusive/Inclusive states in packed words.
+ * @return number of words used.
+ */
+static int pfw_compile_pack(pfw_system_t* system, uint64_t* packed)
+{
+    pfw_criterion_t* criterion;
+    int i, width, used = 0, nb = 0;
+
+    for (i = 0; (criterion = pfw_vector_get(system->criteria, i)); i++) {
+        width = pfw_compile_width(criterion);
+        if (width == 0)
+            continue;
+
+        if (nb == 0 || used + width > PFW_PACKED_BITS) {
+            used = 0;
+            nb++;
+        }
+
+        if (packed) {
+            criterion->word = &packed[nb - 1];
+            criterion->shift = used;
+            criterion->field = ((1ull << (width - 1) << 1) - 1) << used;
+            pfw_criterion_store(criterion, criterion->state);
+        }
+
+        used += width;
+    }
+
+    return nb;
+}
+
+static int pfw_compile_count(pfw_rule_t* rule)
+{
+    pfw_rule_t* sub;
+    int i, nb = 0;
+
+    if (!rule)
+        return 0;
+
+    if (rule->predicate != PFW_PREDICATE_ALL
+        && rule->predicate != PFW_PREDICATE_ANY)
+        return 1;
+
+    for (i = 0; (sub = pfw_vector_get(rule->branches, i)); i++)
+        nb += pfw_compile_count(sub);
+
+    return nb;
+}
+
+/**
+ * @brief Convert leaf into a test on packed states.
+ * @return false if leaf can't be tested by mask.
+ */
+static bool pfw_compile_bits(pfw_rule_t* rule, uint64_t* mask,
+    uint64_t* expect)
+{
+    pfw_criterion_t* criterion;
+    uint64_t v;
+
+    if (rule->predicate == PFW_PREDICATE_ALL
+        || rule->predicate == PFW_PREDICATE_ANY
+        || rule->predicate == PFW_PREDICATE_COND)
+        return false;
+
+    criterion = rule->criterion.p;
+    if (!criterion->word)
+        return false;
+
+    v = (uint64_t)(uint32_t)rule->state.v << criterion->shift;
+
+    switch (rule->predicate) {
+    case PFW_PREDICATE_IS:
+        *mask = criterion->field;
+        *expect = v;
+        return true;
+
+    case PFW_PREDICATE_INCLUDES:
+        /* Includes any of several bits is not a conjunction, and of no
+         * bit is always false.
+         */
+
+        if (!rule->state.v || (rule->state.v & (rule->state.v - 1)))
+            return false;
+
+        *mask = *expect = v;
+        return true;
+
+    case PFW_PREDICATE_INCLUDESALL:
+        *mask = *expect = v;
+        return true;
+
+    case PFW_PREDICATE_EXCLUDES:
+        *mask = v;
+        *expect = 0;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Emit the leaves of ALL that test packed states in word.
+ * @return entry pc, or f if these leaves can never be all true.
+ */
+static int pfw_compile_mask(pfw_program_t* program, int* pos,
+    pfw_rule_t* rule, const uint64_t* word, int t, int f)
+{
+    uint64_t mask = 0, expect = 0, m, e;
+    pfw_insn_t* insn;
+    pfw_rule_t* sub;
+    int i;
+
+    for (i = 0; (sub = pfw_vector_get(rule->branches, i)); i++) {
+        if (!pfw_compile_bits(sub, &m, &e) || sub->criterion.p->word != word)
+            continue;
+
+        if (mask & m & (expect ^ e))
+            return f;
+
+        mask |= m;
+        expect |= e;
+    }
+
+    insn = &program->insns[--(*pos)];
+    insn->opcode = PFW_OPCODE_MASK;
+    insn->u.bits.word = word;
+    insn->u.bits.mask = mask;
+    insn->u.bits.expect = expect;
+    insn->t = t;
+    insn->f = f;
+    return *pos;
+}
+
+/**
+ * @brief Emit rule jumping to t or f, return its entry pc.
+ *
+ * Instructions are emitted backwards from the end of the program,
+ * so the following instruction always exists when jumping to it.
+ */
+static int pfw_compile_rule(pfw_program_t* program, int* pos,
+    pfw_rule_t* rule, int t, int f)
+{
+    pfw_rule_t *sub, *prev;
+    pfw_insn_t* insn;
+    int i, j, next;
+    uint64_t m, e;
+
+    switch (rule->predicate) {
+    case PFW_PREDICATE_ALL:
+        /* Leaves on packed states run first, one test per word. */
+
+        next = t;
+        for (i = pfw_vector_count(rule->branches) - 1; i >= 0; i--) {
+            sub = pfw_vector_get(rule->branches, i);
+            if (!pfw_compile_bits(sub, &m, &e))
+                next = pfw_compile_rule(program, pos, sub, next, f);
+        }
+
+        /* Word is tested where its first leaf is, emitted backwards. */
+
+        for (i = pfw_vector_count(rule->branches) - 1; i >= 0; i--) {
+            sub = pfw_vector_get(rule->branches, i);
+            if (!pfw_compile_bits(sub, &m, &e))
+                continue;
+
+            for (j = 0; j < i; j++) {
+                prev = pfw_vector_get(rule->branches, j);
+                if (pfw_compile_bits(prev, &m, &e)
+                    && prev->criterion.p->word == sub->criterion.p->word)
+                    break;
+            }
+
+            if (j == i)
+                next = pfw_compile_mask(program, pos, rule,
+                    sub->criterion.p->word, next, f);
+        }
+
+        return next;
+
+    case PFW_PREDICATE_ANY:
+        /* ANY without branch is true, @see pfw_rule_match(). */
+
+        if (pfw_vector_count(rule->branches) == 0)
+            return t;
+
+        next = f;
+        for (i = pfw_vector_count(rule->branches) - 1; i >= 0; i--) {
+            sub = pfw_vector_get(rule->branches, i);
+            next = pfw_compile_rule(program, pos, sub, t, next);
+        }
+
+        return next;
+    }
+
+    insn = &program->insns[--(*pos)];
+    insn->opcode = rule->predicate;
+    insn->t = t;
+    insn->f = f;
+
+    if (rule->predicate == PFW_PREDICATE_COND) {
+        insn->u.cond = rule->state.cond;
+        return *pos;
+    }
+
+    insn->u.leaf.state = &rule->criterion.p->state;
+    insn->u.leaf.leaf = rule->leaf;
+
+    if (rule->predicate == PFW_PREDICATE_IN
+        || rule->predicate == PFW_PREDICATE_NOTIN) {
+        insn->u.leaf.left = rule->state.itv->left;
+        insn->u.leaf.right = rule->state.itv->right;
+    } else {
+        insn->u.leaf.left = insn->u.leaf.right = rule->state.v;
+    }
+
+    return *pos;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * @brief Lower rule tree into a flat program.
+ */
+pfw_program_t* pfw_program_compile(pfw_rule_t* rule)
+{
+    pfw_program_t* program;
+    int nb, pos;
+
+    nb = pfw_compile_count(rule);
+    program = calloc(1, sizeof(pfw_program_t) + nb * sizeof(pfw_insn_t));
+    if (!program)
+        return NULL;
+
+    pos = program->nb = nb;
+    program->entry = PFW_PC_TRUE;
+    if (rule)
+        program->entry = pfw_compile_rule(program, &pos, rule,
+            PFW_PC_TRUE, PFW_PC_FALSE);
+
+    return program;
+}
+
+/**
+ * @brief Run program, same result as pfw_rule_match() on its rule.
+ * @param results Leaf results by pfw_sweep_run(), NULL to test leaves.
+ */
+bool pfw_program_run(pfw_program_t* program, const uint8_t* results)
+{
+    const pfw_insn_t* insn;
+    int pc = program->entry;
+    int32_t s;
+    bool res;
+
+    while (pc >= 0) {
+        insn = &program->insns[pc];
+        if (insn->opcode == PFW_OPCODE_MASK) {
+            res = (*insn->u.bits.word & insn->u.bits.mask)
+                == insn->u.bits.expect;
+            pc = res ? insn->t : insn->f;
+            continue;
+        }
+
+        if (insn->opcode == PFW_PREDICATE_COND) {
+            pc = pfw_condition_match(insn->u.cond) ? insn->t : insn->f;
+            continue;
+        }
+
+        if (results && insn->u.leaf.leaf >= 0) {
+            pc = results[insn->u.leaf.leaf] ? insn->t : insn->f;
+            continue;
+        }
+
+        s = *insn->u.leaf.state;
+        switch (insn->opcode) {
+        case PFW_PREDICATE_IS:
+            res = s == insn->u.leaf.left;
+            break;
+
+        case PFW_PREDICATE_ISNOT:
+            res = s != insn->u.leaf.left;
+            break;
+
+        case PFW_PREDICATE_INCLUDES:
+            res = s & insn->u.leaf.left;
+            break;
+
+        case PFW_PREDICATE_EXCLUDES:
+            res = !(s & insn->u.leaf.left);
+            break;
+
+        case PFW_PREDICATE_INCLUDESALL:
+            res = (s & insn->u.leaf.left) == insn->u.leaf.left;
+            break;
+
+        case PFW_PREDICATE_INSET:
+            res = s >= 0 && s < 32 && ((uint32_t)1 << s) & insn->u.leaf.left;
+            break;
+
+        case PFW_PREDICATE_IN:
+            res = s >= insn->u.leaf.left && s <= insn->u.leaf.right;
+            break;
+
+        case PFW_PREDICATE_NOTIN:
+            res = s < insn->u.leaf.left || s > insn->u.leaf.right;
+            break;
+
+        default:
+            res = false;
+            break;
+        }
+
+        pc = res ? insn->t : insn->f;
+    }
+
+    return pc == PFW_PC_TRUE;
+}
+
+void pfw_program_free(pfw_program_t* program)
+{
+    free(program);
+}
+
+/**
+ * @brief Compile config name and act params into templates.
+ */
+static bool pfw_compile_templates(pfw_config_t* config)
+{
+    pfw_act_t* act;
+    int i;
+
+    config->tmpl = pfw_template_compile(config->name);
+    if (!config->tmpl)
+        return false;
+
+    for (i = 0; (act = pfw_vector_get(config->acts, i)); i++) {
+        act->tmpl = pfw_template_compile(act->param);
+        if (!act->tmpl)
+            return false;
+
+        if (act->plugin.p->argv && !pfw_template_split(act->tmpl))
+            return false;
+    }
+
+    return true;
+}
+
+bool pfw_compile_settings(pfw_system_t* system)
+{
+    pfw_condition_t* condition;
+    pfw_domain_t* domain;
+    pfw_config_t* config;
+    int i, j, nb;
+
+    if (!pfw_sweep_build(system))
+        return false;
+
+    nb = pfw_compile_pack(system, NULL);
+    if (nb > 0) {
+        system->packed = calloc(nb, sizeof(uint64_t));
+        if (!system->packed)
+            return false;
+
+        pfw_compile_pack(system, system->packed);
+    }
+
+    for (i = 0; (condition = pfw_vector_get(system->conditions, i)); i++) {
+        condition->program = pfw_program_compile(condition->rules);
+        if (!condition->program) {
+            PFW_DEBUG("Compile condition '%s' failed\n", condition->name);
+            return false;
+        }
+    }
+
+    for (i = 0; (domain = pfw_vector_get(system->domains, i)); i++) {
+        if (domain->gate && domain->gate->rules) {
+            domain->gate->program = pfw_program_compile(domain->gate->rules);
+            if (!domain->gate->program)
+                return false;
+        }
+
+        for (j = 0; (config = pfw_vector_get(domain->configs, j)); j++) {
+            config->program = pfw_program_compile(config->rules);
+            if (!config->program) {
+                PFW_DEBUG("Compile %dth config in domain '%s' failed\n",
+                    j, domain->name);
+                return false;
+            }
+
+            if (!pfw_compile_templates(config))
+                return false;
+        }
+
+        if (!pfw_table_build(domain))
+            return false;
+
+        if (!domain->table && !pfw_bisect_build(domain))
+            return false;
+    }
+
+    return true;
+}
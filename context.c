@@ -118,6 +118,17 @@ char* pfw_context_take_line(pfw_context_t* ctx)
     return line;
 }
 
+/**
+ * @brief Rest of current line, without taking it.
+ */
+const char* pfw_context_peek(pfw_context_t* ctx)
+{
+    if (!ctx || !ctx->ptr || ctx->depth < 0)
+        return NULL;
+
+    return ctx->ptr;
+}
+
 int pfw_context_get_depth(pfw_context_t* ctx)
 {
     if (!ctx)
@@ -24,6 +24,7 @@
 
 #include "internal.h"
 #include <errno.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -62,6 +63,12 @@ static inline bool pfw_rule_match_atomic(pfw_rule_t* rule)
     case PFW_PREDICATE_EXCLUDES:
         return !(s1 & s2);
 
+    case PFW_PREDICATE_INCLUDESALL:
+        return (s1 & s2) == s2;
+
+    case PFW_PREDICATE_INSET:
+        return s1 >= 0 && s1 < 32 && ((uint32_t)1 << s1) & s2;
+
     case PFW_PREDICATE_IN:
         return s1 >= itv->left && s1 <= itv->right;
 
@@ -115,53 +122,73 @@ static int pfw_criterion_itoa_atomic(pfw_criterion_t* criterion,
     return -EINVAL;
 }
 
-static bool pfw_criterion_check_integer(pfw_criterion_t* criterion,
-    int32_t state)
-{
-    char tmp[PFW_CRITERION_MAX_LITERAL];
-    pfw_interval_t* interval;
-    int i;
-
-    switch (criterion->type) {
-    case PFW_CRITERION_NUMERICAL:
-        for (i = 0; (interval = pfw_vector_get(criterion->ranges, i)); i++) {
-            if (interval->left <= state && state <= interval->right)
-                return true;
-        }
-        return false;
-
-    case PFW_CRITERION_EXCLUSIVE:
-    case PFW_CRITERION_INCLUSIVE:
-        return pfw_criterion_itoa(criterion, state, tmp, sizeof(tmp))
-            >= 0;
-    }
-
-    return false;
-}
-
 /**
- * @brief Modify criterion state and auto-save.
+ * @brief Modify criterion state, mark dependent domains, auto-save and
+ * recompute derived criteria.
  */
-static inline void
+static void
 pfw_criterion_set(void* handle, pfw_criterion_t* criterion, int32_t state)
 {
     char literal[PFW_CRITERION_MAX_LITERAL];
     pfw_system_t* system = handle;
+    pfw_criterion_t* derived;
     pfw_listener_t* listener;
-    int ret;
+    pfw_domain_t* domain;
+    int ret, i;
 
     if (criterion->state != state) {
-        criterion->state = state;
-        ret = pfw_criterion_itoa(criterion, state, literal, PFW_CRITERION_MAX_LITERAL);
-        LIST_FOREACH(listener, &criterion->listeners, entry)
-        {
-            listener->on_change(listener->cookie, criterion->state, ret < 0 ? NULL : literal);
+        pfw_criterion_store(criterion, state);
+        for (i = 0; (domain = pfw_vector_get(criterion->domains, i)); i++) {
+            domain->dirty = true;
+            system->dirty = true;
+        }
+
+        if (!LIST_EMPTY(&criterion->listeners)) {
+            ret = pfw_criterion_itoa(criterion, state, literal, PFW_CRITERION_MAX_LITERAL);
+            LIST_FOREACH(listener, &criterion->listeners, entry)
+            {
+                listener->on_change(listener->cookie, criterion->state, ret < 0 ? NULL : literal);
+            }
         }
-        if (system->on_save)
+        if (system->on_save && !criterion->formula)
             system->on_save(system->cookie, pfw_vector_get(criterion->names, 0), state);
+
+        for (i = 0; (derived = pfw_vector_get(criterion->derived, i)); i++)
+            pfw_criterion_set(handle, derived, pfw_criterion_derive(derived));
     }
 }
 
+/**
+ * @brief Modify InclusiveCriterion with a resolved mask.
+ */
+static int pfw_adjust_inclusive_ref(void* handle, void* ref, int mask,
+    bool include)
+{
+    pfw_system_t* system = handle;
+    pfw_criterion_t* criterion = ref;
+    int32_t state;
+
+    if (!system || !criterion)
+        return -EINVAL;
+
+    if (criterion->type != PFW_CRITERION_INCLUSIVE || criterion->formula)
+        return -EPERM;
+
+    if (!pfw_criterion_check(criterion, mask))
+        return -EINVAL;
+
+    pthread_mutex_lock(&system->mutex);
+    if (include)
+        state = criterion->state | mask;
+    else
+        state = criterion->state & ~mask;
+
+    pfw_criterion_set(handle, criterion, state);
+    pthread_mutex_unlock(&system->mutex);
+
+    return 0;
+}
+
 /**
  * @brief Modify InclusiveCriterion.
  */
@@ -176,7 +203,7 @@ static int pfw_adjust_inclusive(void* handle, const char* name,
     if (!system || !value)
         return -EINVAL;
 
-    criterion = pfw_criteria_find(system->criteria, name);
+    criterion = pfw_criteria_find(system, name);
     if (!criterion)
         return -EINVAL;
 
@@ -187,13 +214,7 @@ static int pfw_adjust_inclusive(void* handle, const char* name,
     if (ret < 0)
         return -EINVAL;
 
-    if (include)
-        state = criterion->state | state;
-    else
-        state = criterion->state & ~state;
-
-    pfw_criterion_set(handle, criterion, state);
-    return 0;
+    return pfw_adjust_inclusive_ref(handle, criterion, state, include);
 }
 
 /**
@@ -205,27 +226,31 @@ static int pfw_adjust_numerical(void* handle, const char* name,
     pfw_system_t* system = handle;
     pfw_criterion_t* criterion;
     int32_t state;
+    int ret = 0;
 
     if (!system)
         return -EINVAL;
 
-    criterion = pfw_criteria_find(system->criteria, name);
+    criterion = pfw_criteria_find(system, name);
     if (!criterion)
         return -EINVAL;
 
-    if (criterion->type != PFW_CRITERION_NUMERICAL)
+    if (criterion->type != PFW_CRITERION_NUMERICAL || criterion->formula)
         return -EPERM;
 
+    pthread_mutex_lock(&system->mutex);
     if (increase)
         state = criterion->state + 1;
     else
         state = criterion->state - 1;
 
-    if (!pfw_criterion_check_integer(criterion, state))
-        return -EINVAL;
+    if (pfw_criterion_check(criterion, state))
+        pfw_criterion_set(handle, criterion, state);
+    else
+        ret = -EINVAL;
+    pthread_mutex_unlock(&system->mutex);
 
-    pfw_criterion_set(handle, criterion, state);
-    return 0;
+    return ret;
 }
 
 /****************************************************************************
@@ -256,11 +281,106 @@ bool pfw_rule_match(pfw_rule_t* rule)
         }
 
         return i == 0;
+
+    case PFW_PREDICATE_COND:
+        return pfw_condition_match(rule->state.cond);
     }
 
     return pfw_rule_match_atomic(rule);
 }
 
+/**
+ * @brief Check wether condition matches, evaluate it only if invalid.
+ */
+bool pfw_condition_match(pfw_condition_t* condition)
+{
+    if (!condition->valid) {
+        if (condition->program)
+            condition->result = pfw_program_run(condition->program, NULL);
+        else
+            condition->result = pfw_rule_match(condition->rules);
+
+        condition->valid = true;
+    }
+
+    return condition->result;
+}
+
+/**
+ * @brief Check wether state is in the range of criterion.
+ */
+bool pfw_criterion_check(pfw_criterion_t* criterion, int32_t state)
+{
+    pfw_interval_t* interval;
+    int i, nb;
+
+    switch (criterion->type) {
+    case PFW_CRITERION_NUMERICAL:
+        for (i = 0; (interval = pfw_vector_get(criterion->ranges, i)); i++) {
+            if (interval->left <= state && state <= interval->right)
+                return true;
+        }
+        return false;
+
+    case PFW_CRITERION_EXCLUSIVE:
+        return state >= 0 && state < pfw_vector_count(criterion->ranges);
+
+    case PFW_CRITERION_INCLUSIVE:
+        nb = pfw_vector_count(criterion->ranges);
+        return nb >= 32 || !(state & ~((1u << nb) - 1));
+    }
+
+    return false;
+}
+
+/**
+ * @brief Write state, and its packed copy if any.
+ */
+void pfw_criterion_store(pfw_criterion_t* criterion, int32_t state)
+{
+    pfw_condition_t* condition;
+    int i;
+
+    for (i = 0; (condition = pfw_vector_get(criterion->conditions, i)); i++)
+        condition->valid = false;
+
+    criterion->state = state;
+    if (criterion->word) {
+        *criterion->word = (*criterion->word & ~criterion->field)
+            | (((uint64_t)(uint32_t)state << criterion->shift) & criterion->field);
+    }
+}
+
+/**
+ * @brief Compute state of derived criterion from its inputs, rounded and
+ * clamped to its ranges.
+ */
+int32_t pfw_criterion_derive(pfw_criterion_t* criterion)
+{
+    pfw_interval_t* interval;
+    double v, lo = INT32_MIN, hi = INT32_MAX;
+    int i;
+
+    for (i = 0; (interval = pfw_vector_get(criterion->ranges, i)); i++) {
+        if (i == 0 || interval->left < lo)
+            lo = interval->left;
+        if (i == 0 || interval->right > hi)
+            hi = interval->right;
+    }
+
+    /* Bounds are integers, so the rounded state stays within them and
+     * converts without overflow.
+     */
+
+    v = pfw_expr_eval(criterion->expr);
+    if (!(v >= lo))
+        v = lo;
+    else if (v > hi)
+        v = hi;
+
+    return (int32_t)round(v);
+}
+
 /**
  * @brief Convert literal state to numerical state.
  */
@@ -343,23 +463,89 @@ int pfw_criterion_itoa(pfw_criterion_t* criterion,
     return -EINVAL;
 }
 
-pfw_criterion_t* pfw_criteria_find(pfw_vector_t* criteria, const char* target)
+/**
+ * @brief Find criterion by any of its names.
+ * @note The index is built by pfw_sanitize_criteria().
+ */
+pfw_criterion_t* pfw_criteria_find(pfw_system_t* system, const char* target)
 {
-    pfw_criterion_t* criterion;
-    const char* name;
-    int i, j;
+    return pfw_hash_find(system->index, target);
+}
 
-    if (!target)
+/* Criterion handles. */
+
+void* pfw_lookup(void* handle, const char* name)
+{
+    pfw_system_t* system = handle;
+
+    if (!system || !name)
         return NULL;
 
-    for (i = 0; (criterion = pfw_vector_get(criteria, i)); i++) {
-        for (j = 0; (name = pfw_vector_get(criterion->names, j)); j++) {
-            if (!strcmp(target, name))
-                return criterion;
-        }
+    return pfw_criteria_find(system, name);
+}
+
+int pfw_literal(void* handle, void* ref, const char* value, int* state)
+{
+    pfw_criterion_t* criterion = ref;
+    int32_t tmp;
+    int ret;
+
+    if (!handle || !criterion || !value || !state)
+        return -EINVAL;
+
+    ret = pfw_criterion_atoi(criterion, value, &tmp);
+    if (ret < 0)
+        return ret;
+
+    *state = tmp;
+    return 0;
+}
+
+int pfw_setint_ref(void* handle, void* ref, int value)
+{
+    pfw_system_t* system = handle;
+    pfw_criterion_t* criterion = ref;
+    int ret = -EINVAL;
+
+    if (!system || !criterion)
+        return ret;
+
+    if (criterion->formula)
+        return -EPERM;
+
+    pthread_mutex_lock(&system->mutex);
+    if (pfw_criterion_check(criterion, value)) {
+        pfw_criterion_set(handle, criterion, value);
+        ret = 0;
     }
+    pthread_mutex_unlock(&system->mutex);
 
-    return NULL;
+    return ret;
+}
+
+int pfw_getint_ref(void* handle, void* ref, int* value)
+{
+    pfw_system_t* system = handle;
+    pfw_criterion_t* criterion = ref;
+
+    if (!system || !criterion || !value)
+        return -EINVAL;
+
+    pthread_mutex_lock(&system->mutex);
+    *value = criterion->state;
+    pthread_mutex_unlock(&system->mutex);
+
+    return 0;
+}
+
+int pfw_include_ref(void* handle, void* ref, int mask)
+{
+    return pfw_adjust_inclusive_ref(handle, ref, mask, true);
+}
+
+int pfw_exclude_ref(void* handle, void* ref, int mask)
+{
+    return pfw_adjust_inclusive_ref(handle, ref, mask, false);
 }
 
 /* Criterion (un)subscribe.*/
@@ -373,7 +559,7 @@ void* pfw_subscribe(void* handle, const char* name, pfw_listen_t cb, void* cooki
     if (!system || !name)
         return NULL;
 
-    criterion = pfw_criteria_find(system->criteria, name);
+    criterion = pfw_criteria_find(system, name);
     if (!criterion)
         return NULL;
 
@@ -410,24 +596,11 @@ void pfw_unsubscribe(void* handle, void* subscriber)
 int pfw_setint(void* handle, const char* name, int value)
 {
     pfw_system_t* system = handle;
-    pfw_criterion_t* criterion;
-    int ret = -EINVAL;
 
     if (!system || !name)
-        return ret;
-
-    criterion = pfw_criteria_find(system->criteria, name);
-    if (!criterion)
-        return ret;
-
-    pthread_mutex_lock(&system->mutex);
-    if (pfw_criterion_check_integer(criterion, value)) {
-        pfw_criterion_set(handle, criterion, value);
-        ret = 0;
-    }
-    pthread_mutex_unlock(&system->mutex);
+        return -EINVAL;
 
-    return ret;
+    return pfw_setint_ref(handle, pfw_criteria_find(system, name), value);
 }
 
 int pfw_setstring(void* handle, const char* name, const char* value)
@@ -440,10 +613,13 @@ int pfw_setstring(void* handle, const char* name, const char* value)
     if (!system || !name || !value)
         return -EINVAL;
 
-    criterion = pfw_criteria_find(system->criteria, name);
+    criterion = pfw_criteria_find(system, name);
     if (!criterion)
         return -EINVAL;
 
+    if (criterion->formula)
+        return -EPERM;
+
     pthread_mutex_lock(&system->mutex);
     ret = pfw_criterion_atoi(criterion, value, &state);
     if (ret >= 0)
@@ -481,10 +657,13 @@ int pfw_reset(void* handle, const char* name)
     if (!system || !name)
         return -EINVAL;
 
-    criterion = pfw_criteria_find(system->criteria, name);
+    criterion = pfw_criteria_find(system, name);
     if (!criterion)
         return -EINVAL;
 
+    if (criterion->formula)
+        return -EPERM;
+
     pthread_mutex_lock(&system->mutex);
     pfw_criterion_set(handle, criterion, criterion->init.v);
     pthread_mutex_unlock(&system->mutex);
@@ -497,20 +676,11 @@ int pfw_reset(void* handle, const char* name)
 int pfw_getint(void* handle, const char* name, int* value)
 {
     pfw_system_t* system = handle;
-    pfw_criterion_t* criterion;
-
-    if (!system || !name || !value)
-        return -EINVAL;
 
-    criterion = pfw_criteria_find(system->criteria, name);
-    if (!criterion)
+    if (!system || !name)
         return -EINVAL;
 
-    pthread_mutex_lock(&system->mutex);
-    *value = criterion->state;
-    pthread_mutex_unlock(&system->mutex);
-
-    return 0;
+    return pfw_getint_ref(handle, pfw_criteria_find(system, name), value);
 }
 
 int pfw_getstring(void* handle, const char* name, char* value, int len)
@@ -522,7 +692,7 @@ int pfw_getstring(void* handle, const char* name, char* value, int len)
     if (!system || !name || !value)
         return -EINVAL;
 
-    criterion = pfw_criteria_find(system->criteria, name);
+    criterion = pfw_criteria_find(system, name);
     if (!criterion)
         return -EINVAL;
 
@@ -545,7 +715,7 @@ int pfw_getrange(void* handle, const char* name, int* min_value, int* max_value)
     if (!system || !name)
         return -EINVAL;
 
-    criterion = pfw_criteria_find(system->criteria, name);
+    criterion = pfw_criteria_find(system, name);
     if (!criterion)
         return -EINVAL;
 
@@ -580,7 +750,7 @@ int pfw_contain(void* handle, const char* name, const char* value,
     if (!system || !name || !value || !contain)
         return -EINVAL;
 
-    criterion = pfw_criteria_find(system->criteria, name);
+    criterion = pfw_criteria_find(system, name);
     if (!criterion)
         return -EINVAL;
 
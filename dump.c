@@ -121,9 +121,10 @@ char* pfw_dump(void* handle)
     pfw_criterion_t* criterion;
     pfw_buffer_t* buf = NULL;
     pfw_domain_t* domain;
+    pfw_config_t* config;
     char* res = NULL;
     char tmp[64];
-    int i;
+    int i, j;
 
     if (!system)
         return NULL;
@@ -150,6 +151,21 @@ char* pfw_dump(void* handle)
             domain->current ? domain->current->current : "");
     }
 
+    if (system->mode & PFW_MODE_PROFILE) {
+        pfw_empty_line(&buf);
+        pfw_buffer_printf(&buf, "| %-32s | %-8s | %-8s | %s\n", "PROFILE",
+            "EVALUATE", "MATCH", "TESTS");
+        pfw_empty_line(&buf);
+        for (i = 0; (domain = pfw_vector_get(system->domains, i)); i++) {
+            for (j = 0; (config = pfw_vector_get(domain->configs, j)); j++) {
+                snprintf(tmp, sizeof(tmp), "%s[%d]", domain->name, j);
+                pfw_buffer_printf(&buf, "| %-32s | %-8" PRIu32 " | %-8" PRIu32
+                                        " | %" PRIu32 "\n",
+                    tmp, config->evaluated, config->matched, config->tests);
+            }
+        }
+    }
+
     pfw_empty_line(&buf);
     pfw_buffer_free(buf, &res);
 
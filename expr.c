@@ -0,0 +1,592 @@
+/****************************************************************************
+ * pfw/expr.c
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.  The
+ * ASF licenses this file to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ ****************************************************************************/
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include "internal.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define PFW_EXPR_MAX_DEPTH 32
+#define PFW_EXPR_MAX_NAME 64
+
+#define PFW_EXPR_CONST 0
+#define PFW_EXPR_LOAD 1
+#define PFW_EXPR_NEG 2
+#define PFW_EXPR_NOT 3
+#define PFW_EXPR_ADD 4
+#define PFW_EXPR_SUB 5
+#define PFW_EXPR_MUL 6
+#define PFW_EXPR_DIV 7
+#define PFW_EXPR_MOD 8
+#define PFW_EXPR_LT 9
+#define PFW_EXPR_LE 10
+#define PFW_EXPR_GT 11
+#define PFW_EXPR_GE 12
+#define PFW_EXPR_EQ 13
+#define PFW_EXPR_NE 14
+#define PFW_EXPR_AND 15
+#define PFW_EXPR_OR 16
+#define PFW_EXPR_MIN 17
+#define PFW_EXPR_MAX 18
+#define PFW_EXPR_SELECT 19
+#define PFW_EXPR_POW 20
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+typedef struct pfw_expr_op_s {
+    int opcode; // @see PFW_EXPR_*
+    union {
+        double v;
+        pfw_criterion_t* criterion;
+    } u;
+} pfw_expr_op_t;
+
+/**
+ * @brief pfw_expr_t is an arithmetic expression over criteria states,
+ * compiled to postfix order.
+ */
+struct pfw_expr_s {
+    int nb;
+    pfw_expr_op_t ops[];
+};
+
+typedef struct pfw_expr_parser_s {
+    const char* p;
+    pfw_system_t* system;
+    int limit; // Only criteria before this index can be referenced.
+    pfw_expr_t* expr;
+    int size;
+    int depth;
+    bool error;
+} pfw_expr_parser_t;
+
+typedef struct pfw_expr_token_s {
+    const char* str;
+    int opcode;
+} pfw_expr_token_t;
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+/* Longer tokens first, so '<=' is not taken as '<'. */
+
+static const pfw_expr_token_t g_pfw_expr_compare[] = {
+    { "<=", PFW_EXPR_LE },
+    { ">=", PFW_EXPR_GE },
+    { "<", PFW_EXPR_LT },
+    { ">", PFW_EXPR_GT },
+    { NULL, 0 },
+};
+
+static const pfw_expr_token_t g_pfw_expr_equal[] = {
+    { "==", PFW_EXPR_EQ },
+    { "!=", PFW_EXPR_NE },
+    { NULL, 0 },
+};
+
+static const pfw_expr_token_t g_pfw_expr_add[] = {
+    { "+", PFW_EXPR_ADD },
+    { "-", PFW_EXPR_SUB },
+    { NULL, 0 },
+};
+
+static const pfw_expr_token_t g_pfw_expr_mul[] = {
+    { "*", PFW_EXPR_MUL },
+    { "/", PFW_EXPR_DIV },
+    { "%", PFW_EXPR_MOD },
+    { NULL, 0 },
+};
+
+static const pfw_expr_token_t g_pfw_expr_func[] = {
+    { "min", PFW_EXPR_MIN },
+    { "max", PFW_EXPR_MAX },
+    { "pow", PFW_EXPR_POW },
+    { NULL, 0 },
+};
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static void pfw_expr_skip(pfw_expr_parser_t* parser)
+{
+    while (isspace((unsigned char)*parser->p))
+        parser->p++;
+}
+
+/**
+ * @brief Take token str if it comes next.
+ */
+static bool pfw_expr_take(pfw_expr_parser_t* parser, const char* str)
+{
+    int len = strlen(str);
+
+    pfw_expr_skip(parser);
+    if (strncmp(parser->p, str, len))
+        return false;
+
+    parser->p += len;
+    return true;
+}
+
+/**
+ * @brief Take the first token of tokens coming next.
+ * @return its opcode, -1 if none.
+ */
+static int pfw_expr_take_any(pfw_expr_parser_t* parser,
+    const pfw_expr_token_t* tokens)
+{
+    int i;
+
+    for (i = 0; tokens[i].str; i++) {
+        if (pfw_expr_take(parser, tokens[i].str))
+            return tokens[i].opcode;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Append op, tracking the depth of the evaluation stack.
+ */
+static void pfw_expr_emit(pfw_expr_parser_t* parser, int opcode,
+    double v, pfw_criterion_t* criterion)
+{
+    pfw_expr_t* expr;
+    int size;
+
+    if (parser->error)
+        return;
+
+    if (!parser->expr || parser->expr->nb == parser->size) {
+        size = parser->size ? parser->size * 2 : 8;
+        expr = realloc(parser->expr,
+            sizeof(pfw_expr_t) + size * sizeof(pfw_expr_op_t));
+        if (!expr) {
+            parser->error = true;
+            return;
+        }
+
+        if (!parser->expr)
+            expr->nb = 0;
+
+        parser->expr = expr;
+        parser->size = size;
+    }
+
+    switch (opcode) {
+    case PFW_EXPR_CONST:
+    case PFW_EXPR_LOAD:
+        if (++parser->depth > PFW_EXPR_MAX_DEPTH) {
+            PFW_DEBUG("Expression nests over %d\n", PFW_EXPR_MAX_DEPTH);
+            parser->error = true;
+            return;
+        }
+        break;
+
+    case PFW_EXPR_NEG:
+    case PFW_EXPR_NOT:
+        break;
+
+    case PFW_EXPR_SELECT:
+        parser->depth -= 2;
+        break;
+
+    default:
+        parser->depth--;
+        break;
+    }
+
+    parser->expr->ops[parser->expr->nb].opcode = opcode;
+    if (criterion)
+        parser->expr->ops[parser->expr->nb].u.criterion = criterion;
+    else
+        parser->expr->ops[parser->expr->nb].u.v = v;
+
+    parser->expr->nb++;
+}
+
+static void pfw_expr_parse_select(pfw_expr_parser_t* parser);
+
+/**
+ * @brief Parse criterion name, or function call.
+ */
+static void pfw_expr_parse_name(pfw_expr_parser_t* parser)
+{
+    char name[PFW_EXPR_MAX_NAME];
+    pfw_criterion_t* criterion;
+    int len, i;
+
+    for (len = 0; isalnum((unsigned char)parser->p[len])
+         || parser->p[len] == '_' || parser->p[len] == '.';
+         len++)
+        ;
+
+    if (len >= PFW_EXPR_MAX_NAME) {
+        PFW_DEBUG("Expression name '%.*s' is too long\n", len, parser->p);
+        parser->error = true;
+        return;
+    }
+
+    memcpy(name, parser->p, len);
+    name[len] = '\0';
+    parser->p += len;
+
+    if (pfw_expr_take(parser, "(")) {
+        for (i = 0; g_pfw_expr_func[i].str; i++) {
+            if (!strcmp(name, g_pfw_expr_func[i].str))
+                break;
+        }
+
+        if (!g_pfw_expr_func[i].str) {
+            PFW_DEBUG("Expression has unknown function '%s'\n", name);
+            parser->error = true;
+            return;
+        }
+
+        pfw_expr_parse_select(parser);
+        if (!parser->error && !pfw_expr_take(parser, ",")) {
+            PFW_DEBUG("Expression function '%s' needs 2 arguments\n", name);
+            parser->error = true;
+            return;
+        }
+
+        pfw_expr_parse_select(parser);
+        if (!parser->error && !pfw_expr_take(parser, ")")) {
+            PFW_DEBUG("Expression function '%s' misses ')'\n", name);
+            parser->error = true;
+            return;
+        }
+
+        pfw_expr_emit(parser, g_pfw_expr_func[i].opcode, 0, NULL);
+        return;
+    }
+
+    criterion = pfw_criteria_find(parser->system, name);
+    if (!criterion || criterion->index >= parser->limit) {
+        PFW_DEBUG("Expression refers to undefined criterion '%s'\n", name);
+        parser->error = true;
+        return;
+    }
+
+    pfw_expr_emit(parser, PFW_EXPR_LOAD, 0, criterion);
+}
+
+static void pfw_expr_parse_primary(pfw_expr_parser_t* parser)
+{
+    char* end;
+    double v;
+
+    if (pfw_expr_take(parser, "(")) {
+        pfw_expr_parse_select(parser);
+        if (!parser->error && !pfw_expr_take(parser, ")")) {
+            PFW_DEBUG("Expression misses ')' before '%s'\n", parser->p);
+            parser->error = true;
+        }
+        return;
+    }
+
+    if (isdigit((unsigned char)*parser->p) || *parser->p == '.') {
+        v = strtod(parser->p, &end);
+        parser->p = end;
+        pfw_expr_emit(parser, PFW_EXPR_CONST, v, NULL);
+        return;
+    }
+
+    if (isalpha((unsigned char)*parser->p) || *parser->p == '_') {
+        pfw_expr_parse_name(parser);
+        return;
+    }
+
+    PFW_DEBUG("Expression has invalid operand '%s'\n", parser->p);
+    parser->error = true;
+}
+
+static void pfw_expr_parse_unary(pfw_expr_parser_t* parser)
+{
+    if (parser->error)
+        return;
+
+    if (pfw_expr_take(parser, "-")) {
+        pfw_expr_parse_unary(parser);
+        pfw_expr_emit(parser, PFW_EXPR_NEG, 0, NULL);
+        return;
+    }
+
+    /* Not '!=' here, binary operators never start an operand. */
+
+    if (pfw_expr_take(parser, "!")) {
+        pfw_expr_parse_unary(parser);
+        pfw_expr_emit(parser, PFW_EXPR_NOT, 0, NULL);
+        return;
+    }
+
+    /* 'a ^ b' binds tighter than unary minus, and to the right. */
+
+    pfw_expr_parse_primary(parser);
+    if (!parser->error && pfw_expr_take(parser, "^")) {
+        pfw_expr_parse_unary(parser);
+        pfw_expr_emit(parser, PFW_EXPR_POW, 0, NULL);
+    }
+}
+
+/**
+ * @brief Parse left associative binary operators of one precedence.
+ */
+static void pfw_expr_parse_binary(pfw_expr_parser_t* parser,
+    const pfw_expr_token_t* tokens, void (*next)(pfw_expr_parser_t*))
+{
+    int opcode;
+
+    next(parser);
+    while (!parser->error && (opcode = pfw_expr_take_any(parser, tokens)) >= 0) {
+        next(parser);
+        pfw_expr_emit(parser, opcode, 0, NULL);
+    }
+}
+
+static void pfw_expr_parse_mul(pfw_expr_parser_t* parser)
+{
+    pfw_expr_parse_binary(parser, g_pfw_expr_mul, pfw_expr_parse_unary);
+}
+
+static void pfw_expr_parse_add(pfw_expr_parser_t* parser)
+{
+    pfw_expr_parse_binary(parser, g_pfw_expr_add, pfw_expr_parse_mul);
+}
+
+static void pfw_expr_parse_compare(pfw_expr_parser_t* parser)
+{
+    pfw_expr_parse_binary(parser, g_pfw_expr_compare, pfw_expr_parse_add);
+}
+
+static void pfw_expr_parse_equal(pfw_expr_parser_t* parser)
+{
+    pfw_expr_parse_binary(parser, g_pfw_expr_equal, pfw_expr_parse_compare);
+}
+
+static void pfw_expr_parse_and(pfw_expr_parser_t* parser)
+{
+    static const pfw_expr_token_t tokens[] = {
+        { "&&", PFW_EXPR_AND },
+        { NULL, 0 },
+    };
+
+    pfw_expr_parse_binary(parser, tokens, pfw_expr_parse_equal);
+}
+
+static void pfw_expr_parse_or(pfw_expr_parser_t* parser)
+{
+    static const pfw_expr_token_t tokens[] = {
+        { "||", PFW_EXPR_OR },
+        { NULL, 0 },
+    };
+
+    pfw_expr_parse_binary(parser, tokens, pfw_expr_parse_and);
+}
+
+/**
+ * @brief Parse 'cond ? a : b', right associative.
+ */
+static void pfw_expr_parse_select(pfw_expr_parser_t* parser)
+{
+    pfw_expr_parse_or(parser);
+    if (parser->error || !pfw_expr_take(parser, "?"))
+        return;
+
+    pfw_expr_parse_select(parser);
+    if (!parser->error && !pfw_expr_take(parser, ":")) {
+        PFW_DEBUG("Expression misses ':' before '%s'\n", parser->p);
+        parser->error = true;
+        return;
+    }
+
+    pfw_expr_parse_select(parser);
+    pfw_expr_emit(parser, PFW_EXPR_SELECT, 0, NULL);
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * @brief Compile expression str over criteria before index limit.
+ * @return expression, NULL if invalid or out of memory.
+ */
+pfw_expr_t* pfw_expr_compile(pfw_system_t* system, const char* str,
+    int limit)
+{
+    pfw_expr_parser_t parser = { 0 };
+
+    if (!str)
+        return NULL;
+
+    parser.p = str;
+    parser.system = system;
+    parser.limit = limit;
+
+    pfw_expr_parse_select(&parser);
+    pfw_expr_skip(&parser);
+    if (!parser.error && *parser.p != '\0') {
+        PFW_DEBUG("Expression has trailing '%s'\n", parser.p);
+        parser.error = true;
+    }
+
+    if (parser.error) {
+        free(parser.expr);
+        return NULL;
+    }
+
+    return parser.expr;
+}
+
+/**
+ * @brief Evaluate expression with current criteria states.
+ *
+ * Division or modulo by zero gives 0.
+ */
+double pfw_expr_eval(pfw_expr_t* expr)
+{
+    double stack[PFW_EXPR_MAX_DEPTH];
+    pfw_expr_op_t* op;
+    double a, b;
+    int sp = 0, i;
+
+    for (i = 0; i < expr->nb; i++) {
+        op = &expr->ops[i];
+        switch (op->opcode) {
+        case PFW_EXPR_CONST:
+            stack[sp++] = op->u.v;
+            continue;
+
+        case PFW_EXPR_LOAD:
+            stack[sp++] = op->u.criterion->state;
+            continue;
+
+        case PFW_EXPR_NEG:
+            stack[sp - 1] = -stack[sp - 1];
+            continue;
+
+        case PFW_EXPR_NOT:
+            stack[sp - 1] = !stack[sp - 1];
+            continue;
+
+        case PFW_EXPR_SELECT:
+            sp -= 2;
+            stack[sp - 1] = stack[sp - 1] ? stack[sp] : stack[sp + 1];
+            continue;
+        }
+
+        b = stack[--sp];
+        a = stack[sp - 1];
+        switch (op->opcode) {
+        case PFW_EXPR_ADD:
+            a = a + b;
+            break;
+        case PFW_EXPR_SUB:
+            a = a - b;
+            break;
+        case PFW_EXPR_MUL:
+            a = a * b;
+            break;
+        case PFW_EXPR_DIV:
+            a = b != 0 ? a / b : 0;
+            break;
+        case PFW_EXPR_MOD:
+            /* Remainder of truncated operands, fmod() stays defined where
+             * int64_t conversions are not: NaN, inf or beyond 2^63.
+             */
+
+            a = trunc(b) != 0 ? fmod(trunc(a), trunc(b)) : 0;
+            break;
+        case PFW_EXPR_LT:
+            a = a < b;
+            break;
+        case PFW_EXPR_LE:
+            a = a <= b;
+            break;
+        case PFW_EXPR_GT:
+            a = a > b;
+            break;
+        case PFW_EXPR_GE:
+            a = a >= b;
+            break;
+        case PFW_EXPR_EQ:
+            a = a == b;
+            break;
+        case PFW_EXPR_NE:
+            a = a != b;
+            break;
+        case PFW_EXPR_AND:
+            a = a && b;
+            break;
+        case PFW_EXPR_OR:
+            a = a || b;
+            break;
+        case PFW_EXPR_MIN:
+            a = a < b ? a : b;
+            break;
+        case PFW_EXPR_MAX:
+            a = a > b ? a : b;
+            break;
+        case PFW_EXPR_POW:
+            a = pow(a, b);
+            break;
+        }
+
+        stack[sp - 1] = a;
+    }
+
+    return stack[0];
+}
+
+/**
+ * @brief Get the i-th criterion expression reads, NULL past the end.
+ *
+ * A criterion read several times is returned several times.
+ */
+pfw_criterion_t* pfw_expr_input(pfw_expr_t* expr, int i)
+{
+    int j;
+
+    for (j = 0; j < expr->nb; j++) {
+        if (expr->ops[j].opcode == PFW_EXPR_LOAD && i-- == 0)
+            return expr->ops[j].u.criterion;
+    }
+
+    return NULL;
+}
+
+void pfw_expr_free(pfw_expr_t* expr)
+{
+    free(expr);
+}
@@ -0,0 +1,150 @@
+/****************************************************************************
+ * pfw/hash.c
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.  The
+ * ASF licenses this file to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ ****************************************************************************/
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include "internal.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define PFW_HASH_MIN_SIZE 8
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+typedef struct pfw_hash_entry_s {
+    const char* key;
+    void* obj;
+} pfw_hash_entry_t;
+
+struct pfw_hash_s {
+    size_t cnt;
+    size_t mask;
+    pfw_hash_entry_t* entries;
+};
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+/**
+ * @brief FNV-1a string hash.
+ */
+static uint32_t pfw_hash_string(const char* key)
+{
+    uint32_t hash = 2166136261u;
+
+    for (; *key; key++) {
+        hash ^= (uint8_t)*key;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Find the slot holding key, or the empty slot it belongs to.
+ */
+static pfw_hash_entry_t* pfw_hash_slot(pfw_hash_t* hash, const char* key)
+{
+    pfw_hash_entry_t* entry;
+    size_t i;
+
+    i = pfw_hash_string(key) & hash->mask;
+    for (;; i = (i + 1) & hash->mask) {
+        entry = &hash->entries[i];
+        if (!entry->key || !strcmp(entry->key, key))
+            return entry;
+    }
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+pfw_hash_t* pfw_hash_create(int nb)
+{
+    pfw_hash_t* hash;
+    size_t size;
+
+    /* Keep load factor under 1/2, so probing always ends. */
+
+    for (size = PFW_HASH_MIN_SIZE; size < 2 * (size_t)nb; size *= 2)
+        ;
+
+    hash = malloc(sizeof(pfw_hash_t));
+    if (!hash)
+        return NULL;
+
+    hash->entries = calloc(size, sizeof(pfw_hash_entry_t));
+    if (!hash->entries) {
+        free(hash);
+        return NULL;
+    }
+
+    hash->cnt = 0;
+    hash->mask = size - 1;
+    return hash;
+}
+
+int pfw_hash_insert(pfw_hash_t* hash, const char* key, void* obj)
+{
+    pfw_hash_entry_t* entry;
+
+    if (!hash || !key)
+        return -EINVAL;
+
+    if (2 * (hash->cnt + 1) > hash->mask + 1)
+        return -ENOSPC;
+
+    entry = pfw_hash_slot(hash, key);
+    if (entry->key)
+        return -EEXIST;
+
+    entry->key = key;
+    entry->obj = obj;
+    hash->cnt++;
+    return 0;
+}
+
+void* pfw_hash_find(pfw_hash_t* hash, const char* key)
+{
+    if (!hash || !key)
+        return NULL;
+
+    return pfw_hash_slot(hash, key)->obj;
+}
+
+void pfw_hash_free(pfw_hash_t* hash)
+{
+    if (hash) {
+        free(hash->entries);
+        free(hash);
+    }
+}
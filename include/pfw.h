@@ -25,12 +25,27 @@
  * Included Files
  ****************************************************************************/
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+/* Apply modes, @see pfw_setmode(). */
+
+#define PFW_MODE_SWEEP (1 << 0) // Evaluate all rule leaves in one pass.
+#define PFW_MODE_PROFILE (1 << 1) // Count rule outcomes, reorder branches.
+#define PFW_MODE_DEDUP (1 << 2) // Defer acts to end of apply, drop repeats.
+
+/* Plugin flags, @see pfw_plugin_def_t. */
+
+#define PFW_PLUGIN_SKIP_SAME (1 << 0) // Skip call with last delivered params.
+
 /****************************************************************************
  * Public Types
  ****************************************************************************/
@@ -40,13 +55,40 @@ typedef void (*pfw_listen_t)(void* cookie, int number, char* literal);
 typedef void (*pfw_load_t)(void* cookie, const char* name, int32_t* state);
 typedef void (*pfw_save_t)(void* cookie, const char* name, int32_t state);
 typedef void (*pfw_release_t)(void* cookie);
+typedef void (*pfw_preview_t)(void* cookie, const char* domain,
+    const char* config, const char* plugin, const char* params);
+
+/* Act parameter split on ';' into commands and ',' into fields. */
+
+typedef struct pfw_arg_t {
+    const char* str;
+    int32_t value; // Valid if is_int.
+    bool is_int; // Integer literal, or a whole NumericalCriterion.
+} pfw_arg_t;
+
+typedef struct pfw_command_t {
+    int argc;
+    const pfw_arg_t* argv;
+} pfw_command_t;
+
+typedef void (*pfw_argv_t)(void* cookie, const pfw_command_t* commands,
+    int nb);
 
 typedef struct pfw_plugin_def_t {
     const char* name;
     void* cookie;
     pfw_callback_t cb;
+    pfw_argv_t argv; // Called instead of cb if set.
+    int flags; // @see PFW_PLUGIN_*
 } pfw_plugin_def_t;
 
+/* Hypothetical criterion state, @see pfw_preview(). */
+
+typedef struct pfw_override_t {
+    const char* name;
+    const char* value; // Literal, '+' or '-' adjusts InclusiveCriterion.
+} pfw_override_t;
+
 /****************************************************************************
  * Public Functions
  ****************************************************************************/
@@ -55,6 +97,14 @@ void* pfw_create(const char* criteria, const char* settings,
     pfw_plugin_def_t* defs, int nb, pfw_load_t on_load,
     pfw_save_t on_save, void* cookie);
 void pfw_apply(void* handle);
+int pfw_apply_domain(void* handle, const char* name);
+int pfw_apply_group(void* handle, const char* const* names, int nb);
+void pfw_apply_priority(void* handle, int priority);
+int pfw_apply_budget(void* handle, int cursor, int max_domains, int max_us);
+int pfw_setmode(void* handle, int mode);
+int pfw_set_workers(void* handle, int nb);
+int pfw_preview(void* handle, const pfw_override_t* overrides, int nb,
+    pfw_preview_t on_act, void* cookie);
 void pfw_destroy(void* handle, pfw_release_t on_release);
 char* pfw_dump(void* handle);
 
@@ -68,6 +118,15 @@ int pfw_increase(void* handle, const char* name);
 int pfw_decrease(void* handle, const char* name);
 int pfw_reset(void* handle, const char* name);
 
+/* Criterion handles, resolve names and literals once for hot paths. */
+
+void* pfw_lookup(void* handle, const char* name);
+int pfw_literal(void* handle, void* ref, const char* value, int* state);
+int pfw_setint_ref(void* handle, void* ref, int value);
+int pfw_getint_ref(void* handle, void* ref, int* value);
+int pfw_include_ref(void* handle, void* ref, int mask);
+int pfw_exclude_ref(void* handle, void* ref, int mask);
+
 /* Criterion subscribe */
 void* pfw_subscribe(void* handle, const char* name,
     pfw_listen_t on_change, void* cookie);
@@ -63,6 +63,7 @@
 
 #define PFW_AMMEND_RAW 1 // Raw string that does not need ammend.
 #define PFW_AMMEND_CRITERION 2 // Ammend with criterion.
+#define PFW_AMMEND_EXPR 3 // Ammend with expression '%{...}%'.
 
 /* Criterion types. */
 
@@ -80,6 +81,11 @@
 #define PFW_PREDICATE_EXCLUDES 6 // True if dose not has this bit.
 #define PFW_PREDICATE_IN 7 // True if in the interval.
 #define PFW_PREDICATE_NOTIN 8 // // True if not in the interval.
+#define PFW_PREDICATE_COND 9 // True if the named condition is true.
+#define PFW_PREDICATE_INSET 10 // True if one of the set, as bitmask.
+#define PFW_PREDICATE_INCLUDESALL 11 // True if has all these bits.
+#define PFW_PREDICATE_INCLUDESANY 12 // Includes as parsed, until sanitized.
+#define PFW_PREDICATE_EXCLUDESALL 13 // Excludes as parsed, until sanitized.
 
 /****************************************************************************
  * Types
@@ -87,6 +93,7 @@
 
 typedef struct pfw_ammend_s pfw_ammend_t;
 typedef struct pfw_context_s pfw_context_t;
+typedef struct pfw_hash_s pfw_hash_t;
 typedef struct pfw_vector_s pfw_vector_t;
 typedef struct pfw_interval_s pfw_interval_t;
 typedef struct pfw_listener_s pfw_listener_t;
@@ -94,10 +101,19 @@ typedef LIST_HEAD(pfw_listener_list_s, pfw_listener_s)
     pfw_listener_list_t;
 typedef LIST_ENTRY(pfw_listener_s) pfw_listener_entry_t;
 typedef struct pfw_criterion_s pfw_criterion_t;
+typedef struct pfw_expr_s pfw_expr_t;
 typedef struct pfw_rule_s pfw_rule_t;
+typedef struct pfw_condition_s pfw_condition_t;
+typedef struct pfw_program_s pfw_program_t;
+typedef struct pfw_template_s pfw_template_t;
+typedef struct pfw_table_s pfw_table_t;
+typedef struct pfw_bisect_s pfw_bisect_t;
+typedef struct pfw_sweep_s pfw_sweep_t;
 typedef struct pfw_act_s pfw_act_t;
 typedef struct pfw_action_s pfw_action_t;
 typedef struct pfw_config_s pfw_config_t;
+typedef struct pfw_gate_s pfw_gate_t;
+typedef struct pfw_pool_s pfw_pool_t;
 typedef struct pfw_domain_s pfw_domain_t;
 typedef struct pfw_plugin_s pfw_plugin_t;
 typedef struct pfw_system_s pfw_system_t;
@@ -112,9 +128,10 @@ typedef struct pfw_system_s pfw_system_t;
 struct pfw_ammend_s {
     int type;
     union {
-        const char* raw;
+        const char* raw; // Text of expression for PFW_AMMEND_EXPR.
         pfw_criterion_t* criterion;
     } u;
+    pfw_expr_t* expr; // Compiled expression.
 };
 
 /**
@@ -145,6 +162,7 @@ struct pfw_listener_s {
  */
 struct pfw_criterion_s {
     int type; // @see PFW_CRITERION_*
+    int index; // Position in pfw_system_t::criteria.
     pfw_vector_t* names;
     pfw_vector_t* ranges;
     int32_t state;
@@ -153,6 +171,14 @@ struct pfw_criterion_s {
         int32_t v;
     } init;
     pfw_listener_list_t listeners;
+    pfw_vector_t* domains; // Domains to re-evaluate when state changes.
+    pfw_vector_t* conditions; // Conditions to invalidate when state changes.
+    pfw_vector_t* derived; // Derived criteria to recompute when state changes.
+    const char* formula; // DerivedCriterion only, NULL otherwise.
+    pfw_expr_t* expr; // Compiled formula.
+    uint64_t* word; // Packed copy of state, NULL if not packed.
+    uint64_t field; // Bits of state in packed word.
+    int shift;
 };
 
 /**
@@ -174,7 +200,28 @@ struct pfw_rule_s {
         int32_t v;
         const char* def;
         pfw_interval_t* itv;
+        pfw_condition_t* cond; // PFW_PREDICATE_COND, criterion is its name.
     } state;
+    int leaf; // Leaf number in sweep, -1 for branch node.
+    int refs; // Rules are shared by the optimizer.
+    uint32_t hits; // Evaluations in PFW_MODE_PROFILE.
+    uint32_t trues; // True outcomes in PFW_MODE_PROFILE.
+};
+
+/**
+ * @brief pfw_condition_t is a named rule shared by many configs.
+ *
+ * Its result is memoized until a criterion it depends on changes,
+ * so it is evaluated at most once per apply.
+ *
+ * @see pfw_rule_t pfw_condition_match()
+ */
+struct pfw_condition_s {
+    const char* name;
+    pfw_rule_t* rules;
+    pfw_program_t* program; // Compiled rules.
+    bool valid; // Result is up to date.
+    bool result;
 };
 
 /**
@@ -191,6 +238,7 @@ struct pfw_act_s {
         pfw_plugin_t* p;
     } plugin;
     pfw_vector_t* param; // @see pfw_ammend_t
+    pfw_template_t* tmpl; // Compiled param.
 };
 
 /**
@@ -203,8 +251,32 @@ struct pfw_act_s {
 struct pfw_config_s {
     char* current;
     pfw_vector_t* name; // @see pfw_ammend_t
+    pfw_template_t* tmpl; // Compiled name.
     pfw_rule_t* rules;
+    pfw_program_t* program; // Compiled rules.
     pfw_vector_t* acts;
+    uint32_t evaluated; // Counters of PFW_MODE_PROFILE.
+    uint32_t matched;
+    uint32_t tests; // Leaves tested.
+};
+
+/**
+ * @brief pfw_gate_t decides whether a domain is evaluated at all.
+ *
+ * Gate is open when its rules match, or when the parent domain is in
+ * the named config. Closed domains keep their config and stay dirty,
+ * so they are re-evaluated once the gate opens.
+ *
+ * @see pfw_domain_t
+ */
+struct pfw_gate_s {
+    pfw_rule_t* rules; // NULL if gated by parent domain.
+    pfw_program_t* program; // Compiled rules.
+    union {
+        const char* def;
+        pfw_domain_t* p;
+    } parent;
+    const char* config; // Config name of parent opening the gate.
 };
 
 /**
@@ -218,6 +290,15 @@ struct pfw_domain_s {
     const char* name;
     pfw_config_t* current;
     pfw_vector_t* configs;
+    pfw_vector_t* dead; // Configs that can never win, @see pfw_reach_settings()
+    pfw_table_t* table; // Decision table, NULL if state space is large.
+    pfw_bisect_t* bisect; // Interval index, NULL if not by intervals.
+    bool dirty; // Some criterion it depends on changed since last apply.
+    pfw_gate_t* gate; // NULL if always evaluated.
+    int priority; // Raised to the priority of its gated children.
+    pfw_config_t* selected; // Selected by pool, valid if ready.
+    bool ready;
+    pfw_vector_t* children; // Domains gated by config of this one.
 };
 
 /**
@@ -228,9 +309,12 @@ struct pfw_domain_s {
  */
 struct pfw_plugin_s {
     char* name;
-    char* parameter;
+    const char* parameter; // Last delivered, owned or memoized by template.
+    char* owned;
     void* cookie;
     pfw_callback_t cb;
+    pfw_argv_t argv;
+    int flags; // @see PFW_PLUGIN_*
 };
 
 /**
@@ -247,10 +331,22 @@ struct pfw_system_s {
     pfw_context_t* criteria_ctx;
     pfw_context_t* settings_ctx;
     pfw_vector_t* criteria;
+    pfw_hash_t* index; // Criteria by any of their names.
+    uint64_t* packed; // Exclusive/Inclusive states, for mask tests.
+    pfw_sweep_t* sweep; // All leaves, for PFW_MODE_SWEEP.
+    pfw_pool_t* pool; // Workers selecting configs, NULL if sequential.
+    pfw_vector_t* conditions;
     pfw_vector_t* domains;
+    pfw_vector_t* order; // Domains by priority, then declaration.
+    pfw_hash_t* domain_index; // Domains by name.
     pfw_vector_t* plugins;
+    pfw_vector_t* pending; // Acts deferred by PFW_MODE_DEDUP.
+    pfw_hash_t* deferred; // First pending act by param.
     pfw_load_t on_load; // Load criterion state at initilization.
     pfw_save_t on_save; // Save criterion state when it changes.
+    bool dirty; // Some domain is dirty.
+    int mode; // @see PFW_MODE_*
+    uint32_t applies; // Applies since last reorder, PFW_MODE_PROFILE.
     pthread_mutex_t mutex;
     void* cookie;
 };
@@ -264,33 +360,94 @@ struct pfw_system_s {
 pfw_context_t* pfw_context_create(const char* filename);
 char* pfw_context_take_word(pfw_context_t* ctx);
 char* pfw_context_take_line(pfw_context_t* ctx);
+const char* pfw_context_peek(pfw_context_t* ctx);
 int pfw_context_get_depth(pfw_context_t* ctx);
 void pfw_context_destroy(pfw_context_t* ctx);
 
 int pfw_vector_append(pfw_vector_t** pv, void* obj);
 void* pfw_vector_get(pfw_vector_t* vector, int index);
+void pfw_vector_shrink(pfw_vector_t* vector);
+void pfw_vector_set(pfw_vector_t* vector, int index, void* obj);
+int pfw_vector_count(pfw_vector_t* vector);
 void pfw_vector_free(pfw_vector_t* vector);
 
+pfw_hash_t* pfw_hash_create(int nb);
+int pfw_hash_insert(pfw_hash_t* hash, const char* key, void* obj);
+void* pfw_hash_find(pfw_hash_t* hash, const char* key);
+void pfw_hash_free(pfw_hash_t* hash);
+
 /* Parse functions. */
 
+void pfw_free_rule(pfw_rule_t* rule);
 void pfw_free_criteria(pfw_vector_t* criteria);
-void pfw_free_settings(pfw_vector_t* settings);
+void pfw_free_settings(pfw_vector_t* settings, pfw_vector_t* conditions);
 int pfw_parse_criteria(pfw_context_t* ctx, pfw_vector_t** p);
-int pfw_parse_settings(pfw_context_t* ctx, pfw_vector_t** p);
+int pfw_parse_settings(pfw_context_t* ctx, pfw_vector_t** p,
+    pfw_vector_t** conditions);
 
 bool pfw_sanitize_criteria(pfw_system_t* system);
 bool pfw_sanitize_settings(pfw_system_t* system);
 
+/* Compile functions. */
+
+bool pfw_optimize_settings(pfw_system_t* system);
+bool pfw_compile_settings(pfw_system_t* system);
+pfw_program_t* pfw_program_compile(pfw_rule_t* rule);
+bool pfw_program_run(pfw_program_t* program, const uint8_t* results);
+void pfw_program_free(pfw_program_t* program);
+
+pfw_template_t* pfw_template_compile(pfw_vector_t* ammends);
+int pfw_template_render(pfw_template_t* tmpl, char* res, int len);
+const char* pfw_template_string(pfw_template_t* tmpl, char* buf, int len);
+bool pfw_template_split(pfw_template_t* tmpl);
+const pfw_command_t* pfw_template_args(pfw_template_t* tmpl, int* nb);
+void pfw_template_free(pfw_template_t* tmpl);
+
+bool pfw_table_build(pfw_domain_t* domain);
+void pfw_table_free(pfw_table_t* table);
+pfw_config_t* pfw_domain_select(pfw_domain_t* domain,
+    const uint8_t* results);
+
+bool pfw_bisect_build(pfw_domain_t* domain);
+void pfw_bisect_free(pfw_bisect_t* bisect);
+int pfw_bisect_lookup(pfw_bisect_t* bisect);
+
+void pfw_table_reach(pfw_table_t* table, bool* reached);
+void pfw_bisect_reach(pfw_bisect_t* bisect, bool* reached);
+bool pfw_reach_settings(pfw_system_t* system);
+
+pfw_config_t* pfw_profile_select(pfw_domain_t* domain);
+void pfw_profile_reorder(pfw_system_t* system);
+
+bool pfw_sweep_build(pfw_system_t* system);
+const uint8_t* pfw_sweep_run(pfw_system_t* system);
+void pfw_sweep_free(pfw_sweep_t* sweep);
+
+pfw_pool_t* pfw_pool_create(int nb, int nb_domains);
+void pfw_pool_destroy(pfw_pool_t* pool);
+void pfw_pool_select(pfw_pool_t* pool, pfw_system_t* system, int cursor,
+    const uint8_t* results);
+
+pfw_expr_t* pfw_expr_compile(pfw_system_t* system, const char* str,
+    int limit);
+double pfw_expr_eval(pfw_expr_t* expr);
+pfw_criterion_t* pfw_expr_input(pfw_expr_t* expr, int i);
+void pfw_expr_free(pfw_expr_t* expr);
+
 void* pfw_plugin_register(pfw_system_t* system, pfw_plugin_def_t* def);
 
 /* Criterion functions */
 
 bool pfw_rule_match(pfw_rule_t* rule);
+bool pfw_condition_match(pfw_condition_t* condition);
+bool pfw_criterion_check(pfw_criterion_t* criterion, int32_t state);
+void pfw_criterion_store(pfw_criterion_t* criterion, int32_t state);
+int32_t pfw_criterion_derive(pfw_criterion_t* criterion);
 int pfw_criterion_atoi(pfw_criterion_t* criterion,
     const char* value, int32_t* state);
 int pfw_criterion_itoa(pfw_criterion_t* criterion,
     int32_t state, char* res, int len);
-pfw_criterion_t* pfw_criteria_find(pfw_vector_t* criteria,
+pfw_criterion_t* pfw_criteria_find(pfw_system_t* system,
     const char* target);
 
 #endif // PFW_INTERNAL_H
@@ -0,0 +1,501 @@
+/****************************************************************************
+ * pfw/optimizer.c
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.  The
+ * ASF licenses this file to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ ****************************************************************************/
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define PFW_OPTIMIZE_MAXLEN_LEAF 64
+#define PFW_OPTIMIZE_MAXLEN_BRANCH 24 // Per branch.
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+typedef struct pfw_optimize_key_s pfw_optimize_key_t;
+
+/**
+ * @brief Hash key, kept alive as long as the hash.
+ */
+struct pfw_optimize_key_s {
+    pfw_optimize_key_t* next;
+    pfw_rule_t* rule;
+    char str[];
+};
+
+/**
+ * @brief pfw_optimizer_t shares identical subtrees of all rules.
+ *
+ * Rules are rewritten bottom-up, so branches are already unique when
+ * their parent is keyed, and the key refers to them by address. Every
+ * keyed rule is referenced by the optimizer until it finishes, so no
+ * address in a key is reused meanwhile.
+ */
+typedef struct pfw_optimizer_s {
+    pfw_hash_t* hash;
+    pfw_optimize_key_t* keys;
+} pfw_optimizer_t;
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static int pfw_optimize_count(pfw_rule_t* rule)
+{
+    pfw_rule_t* sub;
+    int i, nb = 1;
+
+    if (!rule)
+        return 0;
+
+    for (i = 0; (sub = pfw_vector_get(rule->branches, i)); i++)
+        nb += pfw_optimize_count(sub);
+
+    return nb;
+}
+
+static inline bool pfw_optimize_branch(pfw_rule_t* rule)
+{
+    return rule->predicate == PFW_PREDICATE_ALL
+        || rule->predicate == PFW_PREDICATE_ANY;
+}
+
+/**
+ * @brief Whether rule is ALL or ANY without branch, always true.
+ */
+static inline bool pfw_optimize_true(pfw_rule_t* rule)
+{
+    return pfw_optimize_branch(rule) && pfw_vector_count(rule->branches) == 0;
+}
+
+/**
+ * @brief Canonical set test of leaf under rule: Is, In {} and Includes
+ * in ANY, Excludes and IncludesAll in ALL.
+ * @return false if leaf is no such set test.
+ */
+static bool pfw_optimize_canon(pfw_rule_t* rule, pfw_rule_t* leaf,
+    int* predicate, int32_t* mask)
+{
+    *predicate = leaf->predicate;
+    *mask = leaf->state.v;
+
+    if (rule->predicate == PFW_PREDICATE_ANY) {
+        switch (leaf->predicate) {
+        case PFW_PREDICATE_IS:
+            if (leaf->state.v < 0 || leaf->state.v >= 32)
+                return false;
+
+            *predicate = PFW_PREDICATE_INSET;
+            *mask = (uint32_t)1 << leaf->state.v;
+            return true;
+
+        case PFW_PREDICATE_INCLUDES:
+        case PFW_PREDICATE_INSET:
+            return true;
+        }
+
+        return false;
+    }
+
+    /* Includes of no bit is false, IncludesAll of none would be true. */
+
+    switch (leaf->predicate) {
+    case PFW_PREDICATE_INCLUDES:
+        if (!leaf->state.v || (leaf->state.v & (leaf->state.v - 1)))
+            return false;
+
+        *predicate = PFW_PREDICATE_INCLUDESALL;
+        return true;
+
+    case PFW_PREDICATE_EXCLUDES:
+    case PFW_PREDICATE_INCLUDESALL:
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Whether leaves a and b can be one leaf testing both bit sets.
+ */
+static bool pfw_optimize_mergeable(pfw_rule_t* rule, pfw_rule_t* a,
+    pfw_rule_t* b)
+{
+    int32_t ma, mb;
+    int pa, pb;
+
+    return a->criterion.p == b->criterion.p
+        && pfw_optimize_canon(rule, a, &pa, &ma)
+        && pfw_optimize_canon(rule, b, &pb, &mb) && pa == pb;
+}
+
+static void pfw_optimize_release(pfw_vector_t* branches)
+{
+    pfw_rule_t* sub;
+    int i;
+
+    for (i = 0; (sub = pfw_vector_get(branches, i)); i++)
+        pfw_free_rule(sub);
+
+    pfw_vector_free(branches);
+}
+
+/**
+ * @brief Append branch to vector, taking one reference.
+ */
+static bool pfw_optimize_append(pfw_vector_t** pv, pfw_rule_t* sub)
+{
+    if (pfw_vector_append(pv, sub) < 0)
+        return false;
+
+    sub->refs++;
+    return true;
+}
+
+/**
+ * @brief Build canonical key of rule, whose branches are already shared.
+ */
+static pfw_optimize_key_t* pfw_optimize_key(pfw_rule_t* rule)
+{
+    pfw_optimize_key_t* key;
+    pfw_rule_t* sub;
+    size_t len, pos;
+    int i, nb;
+
+    nb = pfw_vector_count(rule->branches);
+    len = PFW_OPTIMIZE_MAXLEN_LEAF + nb * PFW_OPTIMIZE_MAXLEN_BRANCH;
+    key = malloc(sizeof(pfw_optimize_key_t) + len);
+    if (!key)
+        return NULL;
+
+    switch (rule->predicate) {
+    case PFW_PREDICATE_ALL:
+    case PFW_PREDICATE_ANY:
+        /* Empty ALL and ANY are the same constant. */
+
+        if (nb == 0) {
+            strcpy(key->str, "T");
+            break;
+        }
+
+        pos = snprintf(key->str, len, "%d", rule->predicate);
+        for (i = 0; (sub = pfw_vector_get(rule->branches, i)); i++)
+            pos += snprintf(key->str + pos, len - pos, ":%p", (void*)sub);
+        break;
+
+    case PFW_PREDICATE_COND:
+        snprintf(key->str, len, "%d:%p", rule->predicate,
+            (void*)rule->state.cond);
+        break;
+
+    case PFW_PREDICATE_IN:
+    case PFW_PREDICATE_NOTIN:
+        snprintf(key->str, len, "%d:%p:%d:%d", rule->predicate,
+            (void*)rule->criterion.p, (int)rule->state.itv->left,
+            (int)rule->state.itv->right);
+        break;
+
+    default:
+        snprintf(key->str, len, "%d:%p:%d", rule->predicate,
+            (void*)rule->criterion.p, (int)rule->state.v);
+        break;
+    }
+
+    return key;
+}
+
+/**
+ * @brief Replace rule, which is consumed, by an identical one seen
+ * before if any.
+ * @return shared rule, NULL if out of memory.
+ */
+static pfw_rule_t* pfw_optimize_share(pfw_optimizer_t* optimizer,
+    pfw_rule_t* rule)
+{
+    pfw_optimize_key_t* key;
+    pfw_rule_t* same;
+
+    key = pfw_optimize_key(rule);
+    if (!key) {
+        pfw_free_rule(rule);
+        return NULL;
+    }
+
+    same = pfw_hash_find(optimizer->hash, key->str);
+    if (same) {
+        free(key);
+        same->refs++;
+        pfw_free_rule(rule);
+        return same;
+    }
+
+    if (pfw_hash_insert(optimizer->hash, key->str, rule) < 0) {
+        free(key);
+        pfw_free_rule(rule);
+        return NULL;
+    }
+
+    rule->refs++;
+    key->rule = rule;
+    key->next = optimizer->keys;
+    optimizer->keys = key;
+    return rule;
+}
+
+/**
+ * @brief Merge the set tests of ANY, or of ALL, on the same criterion
+ * into the first of them.
+ */
+static bool pfw_optimize_merge(pfw_optimizer_t* optimizer, pfw_rule_t* rule,
+    pfw_vector_t** pv)
+{
+    pfw_rule_t *sub, *other, *merged;
+    pfw_vector_t* branches = NULL;
+    int i, j, predicate;
+    int32_t mask;
+
+    for (i = 0; (sub = pfw_vector_get(*pv, i)); i++) {
+        for (j = 0; j < i; j++) {
+            if (pfw_optimize_mergeable(rule, pfw_vector_get(*pv, j), sub))
+                break;
+        }
+
+        /* Already merged into an earlier one. */
+
+        if (j < i)
+            continue;
+
+        merged = NULL;
+        for (j = i + 1; (other = pfw_vector_get(*pv, j)); j++) {
+            if (!pfw_optimize_mergeable(rule, sub, other))
+                continue;
+
+            if (!merged) {
+                merged = calloc(1, sizeof(pfw_rule_t));
+                if (!merged)
+                    goto err;
+
+                *merged = *sub;
+                merged->refs = 1;
+                pfw_optimize_canon(rule, sub, &merged->predicate,
+                    &merged->state.v);
+            }
+
+            pfw_optimize_canon(rule, other, &predicate, &mask);
+            merged->state.v |= mask;
+        }
+
+        if (!merged) {
+            if (!pfw_optimize_append(&branches, sub))
+                goto err;
+
+            continue;
+        }
+
+        merged = pfw_optimize_share(optimizer, merged);
+        if (!merged)
+            goto err;
+
+        if (pfw_vector_append(&branches, merged) < 0) {
+            pfw_free_rule(merged);
+            goto err;
+        }
+    }
+
+    pfw_optimize_release(*pv);
+    *pv = branches;
+    return true;
+
+err:
+    pfw_optimize_release(branches);
+    return false;
+}
+
+/**
+ * @brief Rewrite rule, which is consumed, into its shared optimized form.
+ * @return optimized rule, NULL if out of memory.
+ */
+static pfw_rule_t* pfw_optimize_rule(pfw_optimizer_t* optimizer,
+    pfw_rule_t* rule)
+{
+    pfw_vector_t *old, *branches = NULL;
+    pfw_rule_t *sub, *tmp;
+    bool constant = false;
+    int i, j;
+
+    if (!pfw_optimize_branch(rule))
+        return pfw_optimize_share(optimizer, rule);
+
+    old = rule->branches;
+    rule->branches = NULL;
+    for (i = 0; (sub = pfw_vector_get(old, i)); i++) {
+        sub = pfw_optimize_rule(optimizer, sub);
+        if (!sub)
+            goto err_old;
+
+        if (pfw_optimize_true(sub)) {
+            /* True is dropped by ALL, and makes ANY true. */
+
+            if (rule->predicate == PFW_PREDICATE_ANY)
+                constant = true;
+        } else if (sub->predicate == rule->predicate) {
+            /* Flatten ALL in ALL, ANY in ANY. */
+
+            for (j = 0; (tmp = pfw_vector_get(sub->branches, j)); j++) {
+                if (!pfw_optimize_append(&branches, tmp)) {
+                    pfw_free_rule(sub);
+                    goto err_old;
+                }
+            }
+        } else if (!pfw_optimize_append(&branches, sub)) {
+            pfw_free_rule(sub);
+            goto err_old;
+        }
+
+        pfw_free_rule(sub);
+    }
+
+    pfw_vector_free(old);
+
+    if (constant) {
+        pfw_optimize_release(branches);
+        return pfw_optimize_share(optimizer, rule);
+    }
+
+    if (!pfw_optimize_merge(optimizer, rule, &branches))
+        goto err;
+
+    /* Drop duplicates, identical branches are shared by now. */
+
+    for (i = 0; (sub = pfw_vector_get(branches, i)); i++) {
+        for (j = 0; j < i && pfw_vector_get(branches, j) != sub; j++)
+            ;
+
+        if (j == i && !pfw_optimize_append(&rule->branches, sub))
+            goto err;
+    }
+
+    pfw_optimize_release(branches);
+
+    /* ALL and ANY of a single branch is the branch itself. */
+
+    if (pfw_vector_count(rule->branches) == 1) {
+        sub = pfw_vector_get(rule->branches, 0);
+        sub->refs++;
+        pfw_free_rule(rule);
+        return sub;
+    }
+
+    return pfw_optimize_share(optimizer, rule);
+
+err_old:
+    for (i++; (sub = pfw_vector_get(old, i)); i++)
+        pfw_free_rule(sub);
+
+    pfw_vector_free(old);
+
+err:
+    pfw_optimize_release(branches);
+    pfw_free_rule(rule);
+    return NULL;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * @brief Simplify and share rules of all configs and conditions.
+ *
+ * Run after sanitizing, the result has the same semantics.
+ */
+bool pfw_optimize_settings(pfw_system_t* system)
+{
+    pfw_optimizer_t optimizer = { 0 };
+    pfw_condition_t* condition;
+    pfw_optimize_key_t* key;
+    pfw_domain_t* domain;
+    pfw_config_t* config;
+    int i, j, nb = 0;
+    bool ret = true;
+
+    for (i = 0; (condition = pfw_vector_get(system->conditions, i)); i++)
+        nb += pfw_optimize_count(condition->rules);
+
+    for (i = 0; (domain = pfw_vector_get(system->domains, i)); i++) {
+        if (domain->gate)
+            nb += pfw_optimize_count(domain->gate->rules);
+
+        for (j = 0; (config = pfw_vector_get(domain->configs, j)); j++)
+            nb += pfw_optimize_count(config->rules);
+    }
+
+    /* Each node merging set tests replaces at least two nodes, so there
+     * are fewer of them than of original nodes.
+     */
+
+    optimizer.hash = pfw_hash_create(2 * nb);
+    if (!optimizer.hash) {
+        PFW_DEBUG("Optimize rules failed, no memory\n");
+        return false;
+    }
+
+    for (i = 0; ret && (condition = pfw_vector_get(system->conditions, i));
+         i++) {
+        condition->rules = pfw_optimize_rule(&optimizer, condition->rules);
+        ret = condition->rules != NULL;
+    }
+
+    for (i = 0; ret && (domain = pfw_vector_get(system->domains, i)); i++) {
+        if (domain->gate && domain->gate->rules) {
+            domain->gate->rules = pfw_optimize_rule(&optimizer,
+                domain->gate->rules);
+            ret = domain->gate->rules != NULL;
+        }
+
+        for (j = 0; ret && (config = pfw_vector_get(domain->configs, j));
+             j++) {
+            if (config->rules) {
+                config->rules = pfw_optimize_rule(&optimizer, config->rules);
+                ret = config->rules != NULL;
+            }
+        }
+    }
+
+    while ((key = optimizer.keys)) {
+        optimizer.keys = key->next;
+        pfw_free_rule(key->rule);
+        free(key);
+    }
+
+    pfw_hash_free(optimizer.hash);
+    if (!ret)
+        PFW_DEBUG("Optimize rules failed\n");
+
+    return ret;
+}
@@ -53,32 +53,15 @@ static pfw_interval_t* pfw_parse_interval(const char* word)
     return itv;
 }
 
-static void pfw_free_rule(pfw_rule_t* rule)
-{
-    pfw_rule_t* sub;
-    int i;
-
-    if (!rule)
-        return;
-
-    for (i = 0; (sub = pfw_vector_get(rule->branches, i)); i++)
-        pfw_free_rule(sub);
-
-    if (rule->predicate == PFW_PREDICATE_IN
-        || rule->predicate == PFW_PREDICATE_NOTIN)
-        free(rule->state.itv);
-
-    pfw_vector_free(rule->branches);
-    free(rule);
-}
-
 static void pfw_free_ammends(pfw_vector_t* ammends)
 {
     pfw_ammend_t* ammend;
     int i;
 
-    for (i = 0; (ammend = pfw_vector_get(ammends, i)); i++)
+    for (i = 0; (ammend = pfw_vector_get(ammends, i)); i++) {
+        pfw_expr_free(ammend->expr);
         free(ammend);
+    }
 
     pfw_vector_free(ammends);
 }
@@ -89,6 +72,7 @@ static void pfw_free_act(pfw_act_t* act)
         return;
 
     pfw_free_ammends(act->param);
+    pfw_template_free(act->tmpl);
     free(act);
 }
 
@@ -98,15 +82,27 @@ static void pfw_free_config(pfw_config_t* config)
     int i;
 
     pfw_free_rule(config->rules);
+    pfw_program_free(config->program);
     for (i = 0; (act = pfw_vector_get(config->acts, i)); i++)
         pfw_free_act(act);
 
     pfw_free_ammends(config->name);
+    pfw_template_free(config->tmpl);
     pfw_vector_free(config->acts);
     free(config->current);
     free(config);
 }
 
+static void pfw_free_gate(pfw_gate_t* gate)
+{
+    if (!gate)
+        return;
+
+    pfw_free_rule(gate->rules);
+    pfw_program_free(gate->program);
+    free(gate);
+}
+
 static void pfw_free_domain(pfw_domain_t* domain)
 {
     pfw_config_t* config;
@@ -115,10 +111,25 @@ static void pfw_free_domain(pfw_domain_t* domain)
     for (i = 0; (config = pfw_vector_get(domain->configs, i)); i++)
         pfw_free_config(config);
 
+    for (i = 0; (config = pfw_vector_get(domain->dead, i)); i++)
+        pfw_free_config(config);
+
+    pfw_table_free(domain->table);
+    pfw_bisect_free(domain->bisect);
+    pfw_free_gate(domain->gate);
+    pfw_vector_free(domain->children);
     pfw_vector_free(domain->configs);
+    pfw_vector_free(domain->dead);
     free(domain);
 }
 
+static void pfw_free_condition(pfw_condition_t* condition)
+{
+    pfw_free_rule(condition->rules);
+    pfw_program_free(condition->program);
+    free(condition);
+}
+
 static void pfw_free_criterion(pfw_criterion_t* criterion)
 {
     pfw_listener_t *listener, *tmp;
@@ -138,6 +149,10 @@ static void pfw_free_criterion(pfw_criterion_t* criterion)
         free(listener);
     }
 
+    pfw_expr_free(criterion->expr);
+    pfw_vector_free(criterion->derived);
+    pfw_vector_free(criterion->domains);
+    pfw_vector_free(criterion->conditions);
     pfw_vector_free(criterion->ranges);
     pfw_vector_free(criterion->names);
     free(criterion);
@@ -158,6 +173,9 @@ static int pfw_parse_rule(pfw_context_t* ctx, pfw_rule_t** pr, int depth)
     if (!rule)
         return -ENOMEM;
 
+    rule->leaf = -1;
+    rule->refs = 1;
+
     word = pfw_context_take_word(ctx);
     if (!word) {
         PFW_DEBUG("Rule starts with NULL\n");
@@ -169,6 +187,19 @@ static int pfw_parse_rule(pfw_context_t* ctx, pfw_rule_t** pr, int depth)
     } else if (!strcmp(word, "ANY")) {
         rule->predicate = PFW_PREDICATE_ANY;
         branch = true;
+    } else if (!strcmp(word, "COND")) {
+        /* Reference to named condition. */
+
+        rule->predicate = PFW_PREDICATE_COND;
+        rule->criterion.def = pfw_context_take_word(ctx);
+        if (!rule->criterion.def) {
+            PFW_DEBUG("Rule refers to no condition\n");
+            ret = -EINVAL;
+            goto err;
+        }
+
+        pfw_context_take_line(ctx);
+        return 0;
     } else {
         rule->criterion.def = word;
         branch = false;
@@ -192,6 +223,8 @@ static int pfw_parse_rule(pfw_context_t* ctx, pfw_rule_t** pr, int depth)
                 goto err;
             }
         }
+
+        pfw_vector_shrink(rule->branches);
     } else {
         /* Rule leaves. */
 
@@ -206,8 +239,14 @@ static int pfw_parse_rule(pfw_context_t* ctx, pfw_rule_t** pr, int depth)
             rule->predicate = PFW_PREDICATE_ISNOT;
         } else if (!strcmp(word, "Excludes")) {
             rule->predicate = PFW_PREDICATE_EXCLUDES;
+        } else if (!strcmp(word, "ExcludesAll")) {
+            rule->predicate = PFW_PREDICATE_EXCLUDESALL;
         } else if (!strcmp(word, "Includes")) {
             rule->predicate = PFW_PREDICATE_INCLUDES;
+        } else if (!strcmp(word, "IncludesAny")) {
+            rule->predicate = PFW_PREDICATE_INCLUDESANY;
+        } else if (!strcmp(word, "IncludesAll")) {
+            rule->predicate = PFW_PREDICATE_INCLUDESALL;
         } else if (!strcmp(word, "In")) {
             rule->predicate = PFW_PREDICATE_IN;
         } else if (!strcmp(word, "NotIn")) {
@@ -227,6 +266,11 @@ static int pfw_parse_rule(pfw_context_t* ctx, pfw_rule_t** pr, int depth)
             goto err;
         }
 
+        /* Set of literal states, resolved by sanitizer. */
+
+        if (rule->predicate == PFW_PREDICATE_IN && word[0] == '{')
+            rule->predicate = PFW_PREDICATE_INSET;
+
         if (rule->predicate == PFW_PREDICATE_IN
             || rule->predicate == PFW_PREDICATE_NOTIN) {
             rule->state.itv = pfw_parse_interval(word);
@@ -248,32 +292,81 @@ err:
     return ret;
 }
 
-static int pfw_parse_ammends(pfw_context_t* ctx, pfw_vector_t** pv)
+/**
+ * @brief Append one ammend, raw text or expression.
+ */
+static int pfw_parse_ammend(pfw_vector_t** pv, const char* word, int type)
 {
     pfw_ammend_t* ammend;
-    char *word, *saveptr;
     int ret;
 
-    word = pfw_context_take_line(ctx);
-    if (!word)
+    ammend = calloc(1, sizeof(pfw_ammend_t));
+    if (!ammend)
+        return -ENOMEM;
+
+    ammend->type = type;
+    ammend->u.raw = word;
+    ret = pfw_vector_append(pv, ammend);
+    if (ret < 0) {
+        free(ammend);
+        return ret;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Split line on '%', like strtok(), except '%{...}%' which is kept
+ * whole as an expression. Only '{' right after an opening '%' starts one.
+ */
+static int pfw_parse_ammends(pfw_context_t* ctx, pfw_vector_t** pv)
+{
+    char *line, *end;
+    bool open = false;
+    int ret;
+
+    line = pfw_context_take_line(ctx);
+    if (!line)
         return -EINVAL;
 
-    word = strtok_r(word, "%", &saveptr);
-    while (word) {
-        ammend = calloc(1, sizeof(pfw_ammend_t));
-        if (!ammend)
-            return -ENOMEM;
+    while (*line) {
+        if (*line == '%') {
+            open = !open;
+            line++;
+            continue;
+        }
 
-        ammend->u.raw = word;
-        ret = pfw_vector_append(pv, ammend);
-        if (ret < 0) {
-            free(ammend);
-            return ret;
+        if (open && *line == '{') {
+            end = strstr(line, "}%");
+            if (!end) {
+                PFW_DEBUG("Expression '%s' misses '}%%'\n", line);
+                return -EINVAL;
+            }
+
+            *end = '\0';
+            ret = pfw_parse_ammend(pv, line + 1, PFW_AMMEND_EXPR);
+            if (ret < 0)
+                return ret;
+
+            open = false;
+            line = end + 2;
+            continue;
         }
 
-        word = strtok_r(NULL, "%", &saveptr);
+        end = line + strcspn(line, "%");
+        if (*end == '%') {
+            *end++ = '\0';
+            open = !open;
+        }
+
+        ret = pfw_parse_ammend(pv, line, 0);
+        if (ret < 0)
+            return ret;
+
+        line = end;
     }
 
+    pfw_vector_shrink(*pv);
     return 0;
 }
 
@@ -378,6 +471,8 @@ static int pfw_parse_config(pfw_context_t* ctx, pfw_config_t** pc)
         }
     }
 
+    pfw_vector_shrink(config->acts);
+
     return 0;
 
 err:
@@ -385,6 +480,60 @@ err:
     return ret;
 }
 
+static int pfw_parse_gate(pfw_context_t* ctx, pfw_gate_t** pg)
+{
+    pfw_gate_t* gate;
+    char* word;
+    int ret;
+
+    gate = *pg = calloc(1, sizeof(pfw_gate_t));
+    if (!gate)
+        return -ENOMEM;
+
+    pfw_context_take_word(ctx);
+
+    /* Either parent domain and its config, or rules. */
+
+    word = pfw_context_take_word(ctx);
+    if (word) {
+        gate->parent.def = word;
+        gate->config = pfw_context_take_word(ctx);
+        if (!gate->config) {
+            PFW_DEBUG("Gate by domain '%s' has no config\n", word);
+            return -EINVAL;
+        }
+
+        pfw_context_take_line(ctx);
+        return 0;
+    }
+
+    pfw_context_take_line(ctx);
+    ret = pfw_parse_rule(ctx, &gate->rules, 2);
+    if (ret < 0) {
+        PFW_DEBUG("Gate uses invalid rules\n");
+        return ret == EOF ? -EINVAL : ret;
+    }
+
+    return 0;
+}
+
+static int pfw_parse_priority(pfw_context_t* ctx, int* priority)
+{
+    char *word, *end;
+
+    pfw_context_take_word(ctx);
+    word = pfw_context_take_word(ctx);
+    if (!word)
+        return -EINVAL;
+
+    *priority = strtol(word, &end, 0);
+    if (*end != '\0')
+        return -EINVAL;
+
+    pfw_context_take_line(ctx);
+    return 0;
+}
+
 static int pfw_parse_domain(pfw_context_t* ctx, pfw_domain_t** pd)
 {
     pfw_domain_t* domain;
@@ -392,23 +541,12 @@ static int pfw_parse_domain(pfw_context_t* ctx, pfw_domain_t** pd)
     char* word;
     int ret, nb;
 
-    ret = pfw_context_get_depth(ctx);
-    if (ret < 0)
-        return ret;
-
     domain = *pd = calloc(1, sizeof(pfw_domain_t));
     if (!domain)
         return -ENOMEM;
 
     /* domain name. */
 
-    word = pfw_context_take_word(ctx);
-    if (!word || strcmp(word, "domain:")) {
-        PFW_DEBUG("Domain start with '%s'\n", word);
-        ret = -EINVAL;
-        goto err;
-    }
-
     word = pfw_context_take_word(ctx);
     if (!word) {
         PFW_DEBUG("Domain has no name\n");
@@ -419,6 +557,26 @@ static int pfw_parse_domain(pfw_context_t* ctx, pfw_domain_t** pd)
     domain->name = word;
     pfw_context_take_line(ctx);
 
+    /* gate and priority, in any order. */
+
+    while (pfw_context_get_depth(ctx) == 1) {
+        if (!strncmp(pfw_context_peek(ctx), "gate:", 5) && !domain->gate) {
+            ret = pfw_parse_gate(ctx, &domain->gate);
+            if (ret < 0) {
+                PFW_DEBUG("Domain '%s' has invalid gate\n", domain->name);
+                goto err;
+            }
+        } else if (!strncmp(pfw_context_peek(ctx), "priority:", 9)) {
+            ret = pfw_parse_priority(ctx, &domain->priority);
+            if (ret < 0) {
+                PFW_DEBUG("Domain '%s' has invalid priority\n", domain->name);
+                goto err;
+            }
+        } else {
+            break;
+        }
+    }
+
     /* configs. */
 
     for (nb = 0;; nb++) {
@@ -437,6 +595,8 @@ static int pfw_parse_domain(pfw_context_t* ctx, pfw_domain_t** pd)
         }
     }
 
+    pfw_vector_shrink(domain->configs);
+
     return 0;
 
 err:
@@ -444,10 +604,47 @@ err:
     return ret;
 }
 
+static int pfw_parse_condition(pfw_context_t* ctx, pfw_condition_t** pc)
+{
+    pfw_condition_t* condition;
+    int ret;
+
+    condition = *pc = calloc(1, sizeof(pfw_condition_t));
+    if (!condition)
+        return -ENOMEM;
+
+    /* condition name. */
+
+    condition->name = pfw_context_take_word(ctx);
+    if (!condition->name) {
+        PFW_DEBUG("Condition has no name\n");
+        ret = -EINVAL;
+        goto err;
+    }
+
+    pfw_context_take_line(ctx);
+
+    /* condition rules. */
+
+    ret = pfw_parse_rule(ctx, &condition->rules, 1);
+    if (ret < 0) {
+        PFW_DEBUG("Condition '%s' uses invalid rules\n", condition->name);
+        ret = ret == EOF ? -EINVAL : ret;
+        goto err;
+    }
+
+    return 0;
+
+err:
+    pfw_free_condition(condition);
+    return ret;
+}
+
 static int pfw_parse_criterion(pfw_context_t* ctx, pfw_criterion_t** pc)
 {
     pfw_criterion_t* criterion;
     char* word;
+    bool derived;
     int ret, nb;
 
     ret = pfw_context_get_depth(ctx);
@@ -466,7 +663,7 @@ static int pfw_parse_criterion(pfw_context_t* ctx, pfw_criterion_t** pc)
         ret = -EINVAL;
         goto err;
     }
-    if (!strcmp(word, "NumericalCriterion")) {
+    if (!strcmp(word, "NumericalCriterion") || !strcmp(word, "DerivedCriterion")) {
         criterion->type = PFW_CRITERION_NUMERICAL;
     } else if (!strcmp(word, "ExclusiveCriterion")) {
         criterion->type = PFW_CRITERION_EXCLUSIVE;
@@ -478,6 +675,8 @@ static int pfw_parse_criterion(pfw_context_t* ctx, pfw_criterion_t** pc)
         goto err;
     }
 
+    derived = !strcmp(word, "DerivedCriterion");
+
     /* criterion names. */
 
     for (nb = 0;; nb++) {
@@ -494,6 +693,8 @@ static int pfw_parse_criterion(pfw_context_t* ctx, pfw_criterion_t** pc)
             goto err;
     }
 
+    pfw_vector_shrink(criterion->names);
+
     /* criterion ranges. */
 
     for (nb = 0;; nb++) {
@@ -506,6 +707,18 @@ static int pfw_parse_criterion(pfw_context_t* ctx, pfw_criterion_t** pc)
             }
             break;
         } else if (!strcmp(word, "=")) {
+            /* Formula of derived criterion takes the rest of line. */
+
+            if (derived) {
+                criterion->formula = pfw_context_take_line(ctx);
+                if (!criterion->formula || *criterion->formula == '\0') {
+                    PFW_DEBUG("Criterion has no formula after '='\n");
+                    ret = -EINVAL;
+                    goto err;
+                }
+                return ret;
+            }
+
             word = pfw_context_take_word(ctx);
             if (!word) {
                 PFW_DEBUG("Criterion has no value after '='\n");
@@ -540,6 +753,14 @@ static int pfw_parse_criterion(pfw_context_t* ctx, pfw_criterion_t** pc)
         }
     }
 
+    pfw_vector_shrink(criterion->ranges);
+
+    if (derived) {
+        PFW_DEBUG("DerivedCriterion has no formula\n");
+        ret = -EINVAL;
+        goto err;
+    }
+
     pfw_context_take_line(ctx);
     return ret;
 
@@ -552,38 +773,99 @@ err:
  * Public Functions
  ****************************************************************************/
 
-void pfw_free_settings(pfw_vector_t* settings)
+/**
+ * @brief Drop one reference to rule, free it with the last one.
+ */
+void pfw_free_rule(pfw_rule_t* rule)
 {
+    pfw_rule_t* sub;
+    int i;
+
+    if (!rule || --rule->refs > 0)
+        return;
+
+    for (i = 0; (sub = pfw_vector_get(rule->branches, i)); i++)
+        pfw_free_rule(sub);
+
+    if (rule->predicate == PFW_PREDICATE_IN
+        || rule->predicate == PFW_PREDICATE_NOTIN)
+        free(rule->state.itv);
+
+    pfw_vector_free(rule->branches);
+    free(rule);
+}
+
+void pfw_free_settings(pfw_vector_t* settings, pfw_vector_t* conditions)
+{
+    pfw_condition_t* condition;
     pfw_domain_t* domain;
     int i;
 
     for (i = 0; (domain = pfw_vector_get(settings, i)); i++)
         pfw_free_domain(domain);
 
+    for (i = 0; (condition = pfw_vector_get(conditions, i)); i++)
+        pfw_free_condition(condition);
+
     pfw_vector_free(settings);
+    pfw_vector_free(conditions);
 }
 
-int pfw_parse_settings(pfw_context_t* ctx, pfw_vector_t** p)
+/**
+ * @brief Parse domains, and named conditions that may appear between them.
+ * @return number of domains.
+ */
+int pfw_parse_settings(pfw_context_t* ctx, pfw_vector_t** p,
+    pfw_vector_t** conditions)
 {
+    pfw_condition_t* condition;
     pfw_domain_t* domain;
-    int ret, nb;
+    char* word;
+    int ret, nb = 0;
 
-    for (nb = 0;; nb++) {
-        ret = pfw_parse_domain(ctx, &domain);
+    for (;;) {
+        ret = pfw_context_get_depth(ctx);
         if (ret == EOF)
             break;
-        else if (ret < 0) {
-            PFW_DEBUG("Invalid %dth domain\n", nb);
+        else if (ret < 0)
             return ret;
-        }
 
-        ret = pfw_vector_append(p, domain);
-        if (ret < 0) {
-            pfw_free_domain(domain);
-            return ret;
+        word = pfw_context_take_word(ctx);
+        if (word && !strcmp(word, "condition:")) {
+            ret = pfw_parse_condition(ctx, &condition);
+            if (ret < 0) {
+                PFW_DEBUG("Invalid %dth condition\n",
+                    pfw_vector_count(*conditions));
+                return ret;
+            }
+
+            ret = pfw_vector_append(conditions, condition);
+            if (ret < 0) {
+                pfw_free_condition(condition);
+                return ret;
+            }
+        } else if (word && !strcmp(word, "domain:")) {
+            ret = pfw_parse_domain(ctx, &domain);
+            if (ret < 0) {
+                PFW_DEBUG("Invalid %dth domain\n", nb);
+                return ret;
+            }
+
+            ret = pfw_vector_append(p, domain);
+            if (ret < 0) {
+                pfw_free_domain(domain);
+                return ret;
+            }
+
+            nb++;
+        } else {
+            PFW_DEBUG("Settings start with '%s'\n", word);
+            return -EINVAL;
         }
     }
 
+    pfw_vector_shrink(*p);
+    pfw_vector_shrink(*conditions);
     return nb;
 }
 
@@ -621,5 +903,7 @@ int pfw_parse_criteria(pfw_context_t* ctx, pfw_vector_t** p)
         }
     }
 
+    pfw_vector_shrink(*p);
+
     return nb;
 }
@@ -0,0 +1,212 @@
+/****************************************************************************
+ * pfw/pool.c
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.  The
+ * ASF licenses this file to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ ****************************************************************************/
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include "internal.h"
+#include <stdlib.h>
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+/**
+ * @brief pfw_pool_t is a set of workers selecting configs of domains.
+ *
+ * Selection only reads criteria and memoized conditions, so domains
+ * are selected in parallel; acts are applied in order by the caller.
+ */
+struct pfw_pool_s {
+    pthread_t* threads;
+    int nb;
+    pthread_mutex_t lock;
+    pthread_cond_t start; // A batch is ready, or quit.
+    pthread_cond_t done; // All workers left the batch.
+    uint32_t batch; // Batch sequence, workers join each batch once.
+    bool quit;
+    pfw_domain_t** jobs;
+    int nb_jobs;
+    int next; // Next job to take.
+    int busy; // Workers in current batch.
+    const uint8_t* results;
+};
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+/**
+ * @brief Take jobs of current batch until none is left.
+ */
+static void pfw_pool_work(pfw_pool_t* pool)
+{
+    pfw_domain_t* domain;
+
+    while (1) {
+        pthread_mutex_lock(&pool->lock);
+        domain = pool->next < pool->nb_jobs ? pool->jobs[pool->next++] : NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (!domain)
+            return;
+
+        domain->selected = pfw_domain_select(domain, pool->results);
+        domain->ready = true;
+    }
+}
+
+static void* pfw_pool_main(void* arg)
+{
+    pfw_pool_t* pool = arg;
+    uint32_t batch = 0;
+
+    while (1) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->quit && pool->batch == batch)
+            pthread_cond_wait(&pool->start, &pool->lock);
+
+        if (pool->quit) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+
+        batch = pool->batch;
+        pool->busy++;
+        pthread_mutex_unlock(&pool->lock);
+
+        pfw_pool_work(pool);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0)
+            pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * @brief Create pool of nb workers for a system of nb_domains domains.
+ */
+pfw_pool_t* pfw_pool_create(int nb, int nb_domains)
+{
+    pfw_pool_t* pool;
+
+    pool = calloc(1, sizeof(pfw_pool_t));
+    if (!pool)
+        return NULL;
+
+    pool->threads = calloc(nb, sizeof(pthread_t));
+    pool->jobs = calloc(nb_domains + 1, sizeof(pfw_domain_t*));
+    if (!pool->threads || !pool->jobs) {
+        free(pool->threads);
+        free(pool->jobs);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (; pool->nb < nb; pool->nb++) {
+        if (pthread_create(&pool->threads[pool->nb], NULL, pfw_pool_main,
+                pool)
+            != 0) {
+            pfw_pool_destroy(pool);
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+void pfw_pool_destroy(pfw_pool_t* pool)
+{
+    int i;
+
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->nb; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool->jobs);
+    free(pool);
+}
+
+/**
+ * @brief Select configs of dirty domains in parallel, from cursor of
+ * pfw_system_t::order on, into pfw_domain_t::selected.
+ *
+ * Conditions are evaluated first, so workers only read their results.
+ * Gates are left to the caller, selection doesn't depend on them.
+ */
+void pfw_pool_select(pfw_pool_t* pool, pfw_system_t* system, int cursor,
+    const uint8_t* results)
+{
+    pfw_condition_t* condition;
+    pfw_domain_t* domain;
+    int i, nb = 0;
+
+    for (i = cursor; (domain = pfw_vector_get(system->order, i)); i++) {
+        if (domain->dirty)
+            pool->jobs[nb++] = domain;
+    }
+
+    /* Not worth waking workers up. */
+
+    if (nb < 2)
+        return;
+
+    for (i = 0; (condition = pfw_vector_get(system->conditions, i)); i++)
+        pfw_condition_match(condition);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->nb_jobs = nb;
+    pool->next = 0;
+    pool->results = results;
+    pool->batch++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    pfw_pool_work(pool);
+
+    /* Workers not woken yet find no job left, and never touch it. */
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pool->nb_jobs = 0;
+    pthread_mutex_unlock(&pool->lock);
+}
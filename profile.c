@@ -0,0 +1,224 @@
+/****************************************************************************
+ * pfw/profile.c
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.  The
+ * ASF licenses this file to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ ****************************************************************************/
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include "internal.h"
+#include <stdlib.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+/* Counters are halved beyond this, so that recent traffic weighs more. */
+
+#define PFW_PROFILE_MAX_HITS (1u << 16)
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+/**
+ * @brief Same as pfw_rule_match(), counting outcomes of every node.
+ */
+static bool pfw_profile_match(pfw_rule_t* rule, pfw_config_t* config)
+{
+    pfw_condition_t* condition;
+    pfw_rule_t* sub;
+    bool res;
+    int i;
+
+    switch (rule->predicate) {
+    case PFW_PREDICATE_ALL:
+        res = true;
+        for (i = 0; (sub = pfw_vector_get(rule->branches, i)); i++) {
+            if (!pfw_profile_match(sub, config)) {
+                res = false;
+                break;
+            }
+        }
+        break;
+
+    case PFW_PREDICATE_ANY:
+        res = true;
+        for (i = 0; (sub = pfw_vector_get(rule->branches, i)); i++) {
+            res = pfw_profile_match(sub, config);
+            if (res)
+                break;
+        }
+        break;
+
+    case PFW_PREDICATE_COND:
+        condition = rule->state.cond;
+        if (!condition->valid) {
+            condition->result = pfw_profile_match(condition->rules, config);
+            condition->valid = true;
+        }
+
+        res = condition->result;
+        break;
+
+    default:
+        config->tests++;
+        res = pfw_rule_match(rule);
+        break;
+    }
+
+    rule->hits++;
+    if (res)
+        rule->trues++;
+
+    if (rule->hits > PFW_PROFILE_MAX_HITS) {
+        rule->hits /= 2;
+        rule->trues /= 2;
+    }
+
+    return res;
+}
+
+/**
+ * @brief Whether a shall be tested before b in branch node rule.
+ *
+ * ALL tests the most likely false first, ANY the most likely true;
+ * branches never reached go last.
+ */
+static bool pfw_profile_before(pfw_rule_t* rule, pfw_rule_t* a,
+    pfw_rule_t* b)
+{
+    uint64_t ra, rb;
+
+    if (!a->hits || !b->hits)
+        return a->hits && !b->hits;
+
+    /* Compare trues / hits without division. */
+
+    ra = (uint64_t)a->trues * b->hits;
+    rb = (uint64_t)b->trues * a->hits;
+    return rule->predicate == PFW_PREDICATE_ALL ? ra < rb : ra > rb;
+}
+
+/**
+ * @brief Stable sort branches by outcome counters.
+ * @return whether any branch moved.
+ * @note Shared rules are sorted again for each owner, which is harmless.
+ */
+static bool pfw_profile_sort(pfw_rule_t* rule)
+{
+    pfw_rule_t *sub, *tmp;
+    bool moved = false;
+    int i, j;
+
+    if (!rule || !rule->hits)
+        return false;
+
+    for (i = 0; (sub = pfw_vector_get(rule->branches, i)); i++)
+        moved |= pfw_profile_sort(sub);
+
+    for (i = 1; (sub = pfw_vector_get(rule->branches, i)); i++) {
+        for (j = i; j > 0; j--) {
+            tmp = pfw_vector_get(rule->branches, j - 1);
+            if (!pfw_profile_before(rule, sub, tmp))
+                break;
+
+            pfw_vector_set(rule->branches, j, tmp);
+            moved = true;
+        }
+
+        pfw_vector_set(rule->branches, j, sub);
+    }
+
+    return moved;
+}
+
+/**
+ * @brief Recompile rules, keep the old program if out of memory.
+ */
+static void pfw_profile_compile(pfw_rule_t* rule, pfw_program_t** program)
+{
+    pfw_program_t* tmp;
+
+    tmp = pfw_program_compile(rule);
+    if (tmp) {
+        pfw_program_free(*program);
+        *program = tmp;
+    }
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * @brief Select the config domain shall switch to, counting outcomes.
+ * @see pfw_domain_select()
+ */
+pfw_config_t* pfw_profile_select(pfw_domain_t* domain)
+{
+    pfw_config_t* config;
+    bool res;
+    int i;
+
+    for (i = 0; (config = pfw_vector_get(domain->configs, i)); i++) {
+        config->evaluated++;
+        res = !config->rules || pfw_profile_match(config->rules, config);
+        if (res) {
+            config->matched++;
+            return config;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Reorder branches of all rules by their counters, then
+ * recompile programs if anything moved.
+ */
+void pfw_profile_reorder(pfw_system_t* system)
+{
+    pfw_condition_t* condition;
+    pfw_domain_t* domain;
+    pfw_config_t* config;
+    bool moved = false;
+    int i, j;
+
+    for (i = 0; (condition = pfw_vector_get(system->conditions, i)); i++)
+        moved |= pfw_profile_sort(condition->rules);
+
+    for (i = 0; (domain = pfw_vector_get(system->domains, i)); i++) {
+        for (j = 0; (config = pfw_vector_get(domain->configs, j)); j++)
+            moved |= pfw_profile_sort(config->rules);
+    }
+
+    /* Subtrees are shared, so any program might be affected. */
+
+    if (!moved)
+        return;
+
+    for (i = 0; (condition = pfw_vector_get(system->conditions, i)); i++)
+        pfw_profile_compile(condition->rules, &condition->program);
+
+    for (i = 0; (domain = pfw_vector_get(system->domains, i)); i++) {
+        for (j = 0; (config = pfw_vector_get(domain->configs, j)); j++)
+            pfw_profile_compile(config->rules, &config->program);
+    }
+}
@@ -0,0 +1,257 @@
+/****************************************************************************
+ * pfw/reach.c
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.  The
+ * ASF licenses this file to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ ****************************************************************************/
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static inline bool pfw_reach_true(pfw_rule_t* rule)
+{
+    return !rule
+        || ((rule->predicate == PFW_PREDICATE_ALL
+                || rule->predicate == PFW_PREDICATE_ANY)
+            && pfw_vector_count(rule->branches) == 0);
+}
+
+/**
+ * @brief Conservative reachability without index: configs after an
+ * always true one, or with the same rules as an earlier one, never win.
+ */
+static void pfw_reach_scan(pfw_domain_t* domain, bool* reached)
+{
+    pfw_config_t *config, *prev;
+    int i, j;
+
+    for (i = 0; (config = pfw_vector_get(domain->configs, i)); i++) {
+        for (j = 0; j < i; j++) {
+            prev = pfw_vector_get(domain->configs, j);
+            if (prev->rules == config->rules)
+                break;
+        }
+
+        if (j == i)
+            reached[i + 1] = true;
+
+        if (pfw_reach_true(config->rules))
+            return;
+    }
+
+    reached[0] = true;
+}
+
+/**
+ * @brief Whether config name refers to no criterion, so it never changes.
+ */
+static bool pfw_reach_fixed(pfw_config_t* config)
+{
+    pfw_ammend_t* ammend;
+    int i;
+
+    for (i = 0; (ammend = pfw_vector_get(config->name, i)); i++) {
+        if (ammend->type != PFW_AMMEND_RAW)
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Render config name for reports, criteria as '%name%' and
+ * expressions as '%{expr}%'.
+ */
+static void pfw_reach_name(pfw_config_t* config, char* res, int len)
+{
+    pfw_ammend_t* ammend;
+    int pos = 0, ret, i;
+
+    res[0] = '\0';
+    for (i = 0; (ammend = pfw_vector_get(config->name, i)); i++) {
+        if (ammend->type == PFW_AMMEND_RAW)
+            ret = snprintf(res + pos, len - pos, "%s", ammend->u.raw);
+        else if (ammend->type == PFW_AMMEND_EXPR)
+            ret = snprintf(res + pos, len - pos, "%%{%s}%%", ammend->u.raw);
+        else
+            ret = snprintf(res + pos, len - pos, "%%%s%%",
+                (char*)pfw_vector_get(ammend->u.criterion->names, 0));
+
+        if (ret < 0)
+            return;
+
+        pos += ret;
+        if (pos >= len)
+            return;
+    }
+}
+
+/**
+ * @brief Move configs never reached from configs to dead.
+ * @return false only if out of memory.
+ */
+static bool pfw_reach_prune(pfw_domain_t* domain, const bool* reached)
+{
+    pfw_vector_t *configs = NULL, *dead = NULL;
+    char name[PFW_MAXLEN_AMMENDS];
+    pfw_config_t* config;
+    int i, ret;
+
+    for (i = 0; (config = pfw_vector_get(domain->configs, i)); i++) {
+        if (reached[i + 1])
+            ret = pfw_vector_append(&configs, config);
+        else
+            ret = pfw_vector_append(&dead, config);
+
+        if (ret < 0) {
+            pfw_vector_free(configs);
+            pfw_vector_free(dead);
+            return false;
+        }
+    }
+
+    for (i = 0; (config = pfw_vector_get(dead, i)); i++) {
+        pfw_reach_name(config, name, sizeof(name));
+        PFW_DEBUG("Config '%s' in domain '%s' is unreachable\n", name,
+            domain->name);
+        syslog(LOG_WARNING, "pfw domain:%s conf:%s is unreachable\n",
+            domain->name, name);
+    }
+
+    pfw_vector_free(domain->configs);
+    domain->configs = configs;
+    domain->dead = dead;
+    return true;
+}
+
+/**
+ * @brief Stop marking domain dirty, its result never changes.
+ * @return false only if out of memory.
+ */
+static bool pfw_reach_unlink(pfw_system_t* system, pfw_domain_t* domain)
+{
+    pfw_criterion_t* criterion;
+    pfw_vector_t* domains;
+    pfw_domain_t* other;
+    int i, j;
+
+    for (i = 0; (criterion = pfw_vector_get(system->criteria, i)); i++) {
+        domains = NULL;
+        for (j = 0; (other = pfw_vector_get(criterion->domains, j)); j++) {
+            if (other != domain && pfw_vector_append(&domains, other) < 0) {
+                pfw_vector_free(domains);
+                return false;
+            }
+        }
+
+        pfw_vector_free(criterion->domains);
+        criterion->domains = domains;
+    }
+
+    return true;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * @brief Find configs that can never win and domains whose result never
+ * changes, prune them and report them.
+ *
+ * Decision tables and interval indexes give exact answers, other
+ * domains are analyzed conservatively.
+ *
+ * @return false only if out of memory.
+ */
+bool pfw_reach_settings(pfw_system_t* system)
+{
+    pfw_domain_t* domain;
+    pfw_config_t* config;
+    bool* reached;
+    int i, j, nb, outcomes;
+
+    for (i = 0; (domain = pfw_vector_get(system->domains, i)); i++) {
+        nb = pfw_vector_count(domain->configs);
+
+        /* reached[0] stands for no config matching. */
+
+        reached = calloc(nb + 1, sizeof(bool));
+        if (!reached)
+            return false;
+
+        if (domain->table)
+            pfw_table_reach(domain->table, reached);
+        else if (domain->bisect)
+            pfw_bisect_reach(domain->bisect, reached);
+        else
+            pfw_reach_scan(domain, reached);
+
+        for (j = 1; j <= nb && reached[j]; j++)
+            ;
+
+        /* Indexes refer to config positions, rebuild them after pruning. */
+
+        if (j <= nb) {
+            if (!pfw_reach_prune(domain, reached)) {
+                free(reached);
+                return false;
+            }
+
+            pfw_table_free(domain->table);
+            pfw_bisect_free(domain->bisect);
+            domain->table = NULL;
+            domain->bisect = NULL;
+
+            if (!pfw_table_build(domain)
+                || (!domain->table && !pfw_bisect_build(domain))) {
+                free(reached);
+                return false;
+            }
+        }
+
+        for (outcomes = 0, j = 0; j <= nb; j++)
+            outcomes += reached[j];
+
+        free(reached);
+
+        /* Gate rules and config name still depend on criteria. */
+
+        if (outcomes > 1 || (domain->gate && domain->gate->rules))
+            continue;
+
+        config = pfw_vector_get(domain->configs, 0);
+        if (config && !pfw_reach_fixed(config))
+            continue;
+
+        PFW_DEBUG("Domain '%s' never changes\n", domain->name);
+        syslog(LOG_INFO, "pfw domain:%s never changes\n", domain->name);
+        if (!pfw_reach_unlink(system, domain))
+            return false;
+    }
+
+    return true;
+}
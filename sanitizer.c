@@ -23,6 +23,7 @@
  ****************************************************************************/
 
 #include "internal.h"
+#include <inttypes.h>
 #include <string.h>
 
 /****************************************************************************
@@ -64,33 +65,152 @@ static bool pfw_sanitize_string(pfw_vector_t* names)
     return true;
 }
 
-static void pfw_sanitize_ammends(pfw_vector_t* ammends, pfw_system_t* system)
+/**
+ * @brief Record that object depends on criterion, once.
+ */
+static bool pfw_sanitize_append(pfw_vector_t** pv, void* obj)
+{
+    int nb;
+
+    /* Objects are sanitized one by one, so only the last can repeat. */
+
+    nb = pfw_vector_count(*pv);
+    if (nb > 0 && pfw_vector_get(*pv, nb - 1) == obj)
+        return true;
+
+    return pfw_vector_append(pv, obj) >= 0;
+}
+
+/**
+ * @brief Record that domain shall be re-evaluated, or condition shall be
+ * invalidated, when criterion changes.
+ */
+static bool pfw_sanitize_depend(pfw_criterion_t* criterion,
+    pfw_domain_t* domain, pfw_condition_t* condition)
+{
+    if (domain)
+        return pfw_sanitize_append(&criterion->domains, domain);
+
+    return pfw_sanitize_append(&criterion->conditions, condition);
+}
+
+/**
+ * @brief Make domain or condition depend on every criterion that
+ * a sanitized rule reads, through conditions as well.
+ */
+static bool pfw_sanitize_inherit(pfw_rule_t* rules, pfw_domain_t* domain,
+    pfw_condition_t* condition)
+{
+    pfw_rule_t* rule;
+    int i;
+
+    switch (rules->predicate) {
+    case PFW_PREDICATE_ALL:
+    case PFW_PREDICATE_ANY:
+        for (i = 0; (rule = pfw_vector_get(rules->branches, i)); i++) {
+            if (!pfw_sanitize_inherit(rule, domain, condition))
+                return false;
+        }
+
+        return true;
+
+    case PFW_PREDICATE_COND:
+        return pfw_sanitize_inherit(rules->state.cond->rules, domain,
+            condition);
+    }
+
+    return pfw_sanitize_depend(rules->criterion.p, domain, condition);
+}
+
+static bool pfw_sanitize_ammends(pfw_vector_t* ammends, pfw_domain_t* domain,
+    pfw_system_t* system)
 {
     pfw_criterion_t* criterion;
     pfw_ammend_t* ammend;
-    int i;
+    int i, j;
 
     for (i = 0; (ammend = pfw_vector_get(ammends, i)); i++) {
-        criterion = pfw_criteria_find(system->criteria, ammend->u.raw);
+        if (ammend->type == PFW_AMMEND_EXPR) {
+            ammend->expr = pfw_expr_compile(system, ammend->u.raw,
+                pfw_vector_count(system->criteria));
+            if (!ammend->expr) {
+                PFW_DEBUG("Invalid expression '%s'\n", ammend->u.raw);
+                return false;
+            }
+
+            for (j = 0; (criterion = pfw_expr_input(ammend->expr, j)); j++) {
+                if (!pfw_sanitize_depend(criterion, domain, NULL))
+                    return false;
+            }
+
+            continue;
+        }
+
+        criterion = pfw_criteria_find(system, ammend->u.raw);
         if (criterion) {
             ammend->type = PFW_AMMEND_CRITERION;
             ammend->u.criterion = criterion;
+            if (!pfw_sanitize_depend(criterion, domain, NULL))
+                return false;
         } else {
             ammend->type = PFW_AMMEND_RAW;
         }
     }
+
+    return true;
+}
+
+/**
+ * @brief Convert set literal like '{a,b}' into one bitmask: bit of each
+ * state for ExclusiveCriterion, union of bits for InclusiveCriterion.
+ */
+static bool pfw_sanitize_set(pfw_criterion_t* criterion, const char* def,
+    int32_t* mask)
+{
+    char tmp[PFW_MAXLEN_AMMENDS];
+    char *token, *saveptr;
+    int32_t state, res = 0;
+
+    /* mask may share storage with def. */
+
+    strncpy(tmp, def, sizeof(tmp));
+    tmp[sizeof(tmp) - 1] = '\0';
+
+    for (token = strtok_r(tmp, "{,}", &saveptr); token;
+         token = strtok_r(NULL, "{,}", &saveptr)) {
+        if (pfw_criterion_atoi(criterion, token, &state) < 0)
+            return false;
+
+        if (criterion->type == PFW_CRITERION_INCLUSIVE)
+            res |= state;
+        else if (state < 32)
+            res |= (uint32_t)1 << state;
+        else
+            return false;
+    }
+
+    *mask = res;
+    return true;
 }
 
-static bool pfw_sanitize_rules(pfw_rule_t* rules, pfw_system_t* system)
+/**
+ * @brief Resolve rules of a domain, or of a condition.
+ * @param nb Number of conditions visible to rules, so conditions
+ * can only refer to those declared before and never form a cycle.
+ */
+static bool pfw_sanitize_rules(pfw_rule_t* rules, pfw_domain_t* domain,
+    pfw_condition_t* condition, int nb, pfw_system_t* system)
 {
     pfw_criterion_t* criterion;
+    pfw_condition_t* cond;
     pfw_rule_t* rule;
+    bool set = false;
     int i;
 
     if (rules->predicate == PFW_PREDICATE_ALL
         || rules->predicate == PFW_PREDICATE_ANY) {
         for (i = 0; (rule = pfw_vector_get(rules->branches, i)); i++) {
-            if (!pfw_sanitize_rules(rule, system)) {
+            if (!pfw_sanitize_rules(rule, domain, condition, nb, system)) {
                 PFW_DEBUG("Rule branch at %d is invalid\n", i);
                 return false;
             }
@@ -99,37 +219,75 @@ static bool pfw_sanitize_rules(pfw_rule_t* rules, pfw_system_t* system)
         return true;
     }
 
+    /* Santinize condition. */
+
+    if (rules->predicate == PFW_PREDICATE_COND) {
+        for (i = 0; i < nb; i++) {
+            cond = pfw_vector_get(system->conditions, i);
+            if (!strcmp(cond->name, rules->criterion.def)) {
+                rules->state.cond = cond;
+                return pfw_sanitize_inherit(cond->rules, domain, condition);
+            }
+        }
+
+        PFW_DEBUG("Condition '%s' not found\n", rules->criterion.def);
+        return false;
+    }
+
     /* Santinize criterion. */
 
-    criterion = pfw_criteria_find(system->criteria, rules->criterion.def);
+    criterion = pfw_criteria_find(system, rules->criterion.def);
     if (!criterion) {
         PFW_DEBUG("Criterion '%s' not found\n", rules->criterion.def);
         return false;
     }
 
     rules->criterion.p = criterion;
+    if (!pfw_sanitize_depend(criterion, domain, condition))
+        return false;
 
-    /* Santinize state. */
+    /* Santinize state, In/NotIn already hold an interval. */
 
     if (rules->criterion.p->type != PFW_CRITERION_NUMERICAL
-        && pfw_criterion_atoi(rules->criterion.p, rules->state.def, &rules->state.v)
-            < 0) {
-        PFW_DEBUG("Rule has invalid state '%s' for criterion '%s'\n",
-            rules->state.def, (char*)pfw_vector_get(rules->criterion.p->names, 0));
-        return false;
+        && rules->predicate != PFW_PREDICATE_IN
+        && rules->predicate != PFW_PREDICATE_NOTIN) {
+        set = rules->state.def[0] == '{';
+        if (set ? !pfw_sanitize_set(criterion, rules->state.def, &rules->state.v)
+                : pfw_criterion_atoi(criterion, rules->state.def, &rules->state.v)
+                    < 0) {
+            PFW_DEBUG("Rule has invalid state '%s' for criterion '%s'\n",
+                rules->state.def, (char*)pfw_vector_get(criterion->names, 0));
+            return false;
+        }
     }
 
     /* Santinize predicates. */
 
     switch (rules->criterion.p->type) {
     case PFW_CRITERION_EXCLUSIVE:
+        if (rules->predicate == PFW_PREDICATE_INSET)
+            return true;
+
+        /* One state is no set, only single bit predicates apply. */
+
+        if (set || rules->predicate == PFW_PREDICATE_INCLUDESALL
+            || rules->predicate == PFW_PREDICATE_INCLUDESANY
+            || rules->predicate == PFW_PREDICATE_EXCLUDESALL)
+            break;
+
         if (rules->predicate == PFW_PREDICATE_IS
             || rules->predicate == PFW_PREDICATE_ISNOT)
             return true;
 
     case PFW_CRITERION_INCLUSIVE:
+        if (rules->predicate == PFW_PREDICATE_INCLUDESANY)
+            rules->predicate = PFW_PREDICATE_INCLUDES;
+        else if (rules->predicate == PFW_PREDICATE_EXCLUDESALL)
+            rules->predicate = PFW_PREDICATE_EXCLUDES;
+
         if (rules->predicate == PFW_PREDICATE_INCLUDES
-            || rules->predicate == PFW_PREDICATE_EXCLUDES)
+            || rules->predicate == PFW_PREDICATE_EXCLUDES
+            || rules->predicate == PFW_PREDICATE_INCLUDESALL)
             return true;
 
     case PFW_CRITERION_NUMERICAL:
@@ -144,7 +302,8 @@ static bool pfw_sanitize_rules(pfw_rule_t* rules, pfw_system_t* system)
     return false;
 }
 
-static bool pfw_sanitize_act(pfw_act_t* act, pfw_system_t* system)
+static bool pfw_sanitize_act(pfw_act_t* act, pfw_domain_t* domain,
+    pfw_system_t* system)
 {
     pfw_plugin_t* plugin = NULL;
     int i;
@@ -164,8 +323,7 @@ static bool pfw_sanitize_act(pfw_act_t* act, pfw_system_t* system)
 
     act->plugin.p = plugin;
 
-    pfw_sanitize_ammends(act->param, system);
-    return true;
+    return pfw_sanitize_ammends(act->param, domain, system);
 }
 
 static bool pfw_sanitize_config(pfw_config_t* config, pfw_domain_t* domain,
@@ -174,15 +332,19 @@ static bool pfw_sanitize_config(pfw_config_t* config, pfw_domain_t* domain,
     pfw_act_t* act;
     int i;
 
-    pfw_sanitize_ammends(config->name, system);
+    if (!pfw_sanitize_ammends(config->name, domain, system)) {
+        PFW_DEBUG("Bad name in config \n");
+        return false;
+    }
 
-    if (!pfw_sanitize_rules(config->rules, system)) {
+    if (!pfw_sanitize_rules(config->rules, domain, NULL,
+            pfw_vector_count(system->conditions), system)) {
         PFW_DEBUG("Bad rules in config \n");
         return false;
     }
 
     for (i = 0; (act = pfw_vector_get(config->acts, i)); i++) {
-        if (!pfw_sanitize_act(act, system)) {
+        if (!pfw_sanitize_act(act, domain, system)) {
             PFW_DEBUG("Bad act in config\n");
             return false;
         }
@@ -191,6 +353,37 @@ static bool pfw_sanitize_config(pfw_config_t* config, pfw_domain_t* domain,
     return true;
 }
 
+/**
+ * @brief Resolve gate of the nb-th domain, which can only depend on
+ * domains before it, so parents are always applied first.
+ */
+static bool pfw_sanitize_gate(pfw_domain_t* domain, int nb,
+    pfw_system_t* system)
+{
+    pfw_gate_t* gate = domain->gate;
+    pfw_domain_t* parent;
+    int i;
+
+    if (!gate)
+        return true;
+
+    if (gate->rules)
+        return pfw_sanitize_rules(gate->rules, domain, NULL,
+            pfw_vector_count(system->conditions), system);
+
+    for (i = 0; i < nb; i++) {
+        parent = pfw_vector_get(system->domains, i);
+        if (!strcmp(parent->name, gate->parent.def)) {
+            gate->parent.p = parent;
+            return pfw_vector_append(&parent->children, domain) >= 0;
+        }
+    }
+
+    PFW_DEBUG("Gate domain '%s' not found before '%s'\n", gate->parent.def,
+        domain->name);
+    return false;
+}
+
 static bool pfw_sanitize_domain(pfw_domain_t* domain, pfw_system_t* system)
 {
     pfw_config_t* config;
@@ -203,6 +396,38 @@ static bool pfw_sanitize_domain(pfw_domain_t* domain, pfw_system_t* system)
         }
     }
 
+    /* Evaluate every domain on the first apply. */
+
+    domain->dirty = true;
+    system->dirty = true;
+    return true;
+}
+
+/**
+ * @brief Compile formula of derived criterion, register it to its inputs
+ * and compute its initial state.
+ *
+ * Formula only refers to criteria defined before, so no cycle is possible
+ * and inputs are computed first.
+ */
+static bool pfw_sanitize_derived(pfw_criterion_t* criterion, pfw_system_t* system)
+{
+    pfw_criterion_t* input;
+    int i;
+
+    criterion->expr = pfw_expr_compile(system, criterion->formula,
+        criterion->index);
+    if (!criterion->expr) {
+        PFW_DEBUG("Criterion has invalid formula '%s'\n", criterion->formula);
+        return false;
+    }
+
+    for (i = 0; (input = pfw_expr_input(criterion->expr, i)); i++) {
+        if (!pfw_sanitize_append(&input->derived, criterion))
+            return false;
+    }
+
+    criterion->state = criterion->init.v = pfw_criterion_derive(criterion);
     return true;
 }
 
@@ -214,16 +439,24 @@ static bool pfw_sanitize_criterion(pfw_criterion_t* criterion, pfw_system_t* sys
         return false;
     }
 
+    /* Derived criterion is never saved, it is computed from its inputs. */
+
     criterion->state = criterion->init.v;
-    if (system->on_load)
+    if (system->on_load && !criterion->formula)
         system->on_load(system->cookie, pfw_vector_get(criterion->names, 0), &criterion->state);
 
     if (criterion->type != PFW_CRITERION_NUMERICAL
-        && !pfw_sanitize_string(criterion->ranges)) {
-        return false;
+        && !pfw_criterion_check(criterion, criterion->state)) {
+        PFW_DEBUG("Criterion has invalid loaded state '%" PRId32 "'\n", criterion->state);
+        criterion->state = criterion->init.v;
     }
 
-    return pfw_sanitize_string(criterion->names);
+    /* Names are checked by the criteria index. */
+
+    if (criterion->type != PFW_CRITERION_NUMERICAL)
+        return pfw_sanitize_string(criterion->ranges);
+
+    return true;
 }
 
 /****************************************************************************
@@ -232,44 +465,107 @@ static bool pfw_sanitize_criterion(pfw_criterion_t* criterion, pfw_system_t* sys
 
 bool pfw_sanitize_criteria(pfw_system_t* system)
 {
-    pfw_vector_t* names = NULL;
     pfw_criterion_t* criterion;
-    bool result = false;
-    int i, j, ret;
+    int i, j, nb = 0;
     char* name;
 
     for (i = 0; (criterion = pfw_vector_get(system->criteria, i)); i++) {
         if (!pfw_sanitize_criterion(criterion, system))
-            goto out;
+            return false;
+
+        criterion->index = i;
+        for (j = 0; pfw_vector_get(criterion->names, j); j++)
+            nb++;
+    }
+
+    /* Index all names, duplicates are rejected by the index itself. */
 
+    system->index = pfw_hash_create(nb);
+    if (!system->index)
+        return false;
+
+    for (i = 0; (criterion = pfw_vector_get(system->criteria, i)); i++) {
         for (j = 0; (name = pfw_vector_get(criterion->names, j)); j++) {
-            ret = pfw_vector_append(&names, name);
-            if (ret < 0)
-                goto out;
+            if (pfw_hash_insert(system->index, name, criterion) < 0) {
+                PFW_DEBUG("duplicate criterion name '%s'\n", name);
+                return false;
+            }
         }
     }
 
-    result = pfw_sanitize_string(names);
-    if (!result) {
-        PFW_DEBUG("duplicate criterion name\n");
+    for (i = 0; (criterion = pfw_vector_get(system->criteria, i)); i++) {
+        if (criterion->formula && !pfw_sanitize_derived(criterion, system))
+            return false;
     }
 
-out:
-    pfw_vector_free(names);
-    return result;
+    return true;
+}
+
+/**
+ * @brief Index domains by name, and order them by priority.
+ *
+ * A parent takes the priority of its gated children, so it still comes
+ * before them; domains of the same priority keep declaration order.
+ */
+static bool pfw_sanitize_order(pfw_system_t* system)
+{
+    pfw_domain_t *domain, *child, *tmp;
+    int i, j;
+
+    system->domain_index = pfw_hash_create(pfw_vector_count(system->domains));
+    if (!system->domain_index)
+        return false;
+
+    for (i = pfw_vector_count(system->domains) - 1; i >= 0; i--) {
+        domain = pfw_vector_get(system->domains, i);
+        if (pfw_hash_insert(system->domain_index, domain->name, domain) < 0)
+            return false;
+
+        for (j = 0; (child = pfw_vector_get(domain->children, j)); j++) {
+            if (child->priority > domain->priority)
+                domain->priority = child->priority;
+        }
+    }
+
+    for (i = 0; (domain = pfw_vector_get(system->domains, i)); i++) {
+        if (pfw_vector_append(&system->order, domain) < 0)
+            return false;
+
+        for (j = i; j > 0; j--) {
+            tmp = pfw_vector_get(system->order, j - 1);
+            if (tmp->priority >= domain->priority)
+                break;
+
+            pfw_vector_set(system->order, j, tmp);
+        }
+
+        pfw_vector_set(system->order, j, domain);
+    }
+
+    return true;
 }
 
 bool pfw_sanitize_settings(pfw_system_t* system)
 {
+    pfw_condition_t* condition;
     pfw_domain_t* domain;
     int i;
 
+    PFW_SANITIZE_OBJ_NAME(system->conditions, pfw_condition_t, name);
     PFW_SANITIZE_OBJ_NAME(system->domains, pfw_domain_t, name);
 
+    for (i = 0; (condition = pfw_vector_get(system->conditions, i)); i++) {
+        if (!pfw_sanitize_rules(condition->rules, NULL, condition, i, system)) {
+            PFW_DEBUG("Bad rules in condition '%s'\n", condition->name);
+            return false;
+        }
+    }
+
     for (i = 0; (domain = pfw_vector_get(system->domains, i)); i++) {
-        if (!pfw_sanitize_domain(domain, system))
+        if (!pfw_sanitize_domain(domain, system)
+            || !pfw_sanitize_gate(domain, i, system))
             return false;
     }
 
-    return true;
+    return pfw_sanitize_order(system);
 }
@@ -0,0 +1,284 @@
+/****************************************************************************
+ * pfw/sweep.c
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.  The
+ * ASF licenses this file to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ ****************************************************************************/
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include "internal.h"
+#include <stdlib.h>
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+/**
+ * @brief pfw_sweep_t holds every leaf rule in structure-of-arrays form.
+ *
+ * All predicates are normalized to one branch-free test:
+ *   ((state & mask) - left <= span) ^ neg
+ * with unsigned arithmetic, so one loop evaluates all leaves.
+ */
+struct pfw_sweep_s {
+    int nb;
+    int nb_states;
+    uint32_t* index; // Criterion index.
+    uint32_t* mask;
+    uint32_t* left;
+    uint32_t* span;
+    uint8_t* neg;
+    uint8_t* results;
+    int32_t* states;
+};
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+/**
+ * @brief Find the range of states of a set made of consecutive states.
+ * @return false if the set has holes.
+ */
+static bool pfw_sweep_range(uint32_t set, uint32_t* left, uint32_t* span)
+{
+    uint32_t first = 0, high;
+
+    if (!set)
+        return false;
+
+    while (!(set & (1u << first)))
+        first++;
+
+    high = set >> first;
+    if (high & (high + 1))
+        return false;
+
+    *left = first;
+    for (*span = 0; high >>= 1; (*span)++)
+        ;
+
+    return true;
+}
+
+/**
+ * @brief Number leaves of rule, return next leaf number.
+ */
+static int pfw_sweep_number(pfw_rule_t* rule, int nb)
+{
+    uint32_t left, span;
+    pfw_rule_t* sub;
+    int i;
+
+    if (!rule)
+        return nb;
+
+    switch (rule->predicate) {
+    case PFW_PREDICATE_ALL:
+    case PFW_PREDICATE_ANY:
+        for (i = 0; (sub = pfw_vector_get(rule->branches, i)); i++)
+            nb = pfw_sweep_number(sub, nb);
+
+        return nb;
+
+    case PFW_PREDICATE_COND:
+        /* Memoized by the condition itself. */
+
+        return nb;
+
+    case PFW_PREDICATE_INSET:
+        /* Sets with holes are not one range, the program tests them. */
+
+        if (!pfw_sweep_range(rule->state.v, &left, &span))
+            return nb;
+
+        break;
+    }
+
+    /* Shared leaves are evaluated once. */
+
+    if (rule->leaf >= 0)
+        return nb;
+
+    rule->leaf = nb;
+    return nb + 1;
+}
+
+/**
+ * @brief Normalize leaf rule into sweep slot.
+ */
+static void pfw_sweep_fill(pfw_sweep_t* sweep, pfw_rule_t* rule)
+{
+    pfw_interval_t* itv;
+    pfw_rule_t* sub;
+    int i;
+
+    if (!rule)
+        return;
+
+    switch (rule->predicate) {
+    case PFW_PREDICATE_ALL:
+    case PFW_PREDICATE_ANY:
+        for (i = 0; (sub = pfw_vector_get(rule->branches, i)); i++)
+            pfw_sweep_fill(sweep, sub);
+
+        return;
+
+    case PFW_PREDICATE_COND:
+        return;
+    }
+
+    i = rule->leaf;
+    if (i < 0)
+        return;
+
+    sweep->index[i] = rule->criterion.p->index;
+    sweep->mask[i] = UINT32_MAX;
+    sweep->neg[i] = rule->predicate == PFW_PREDICATE_ISNOT
+        || rule->predicate == PFW_PREDICATE_EXCLUDES
+        || rule->predicate == PFW_PREDICATE_NOTIN;
+
+    switch (rule->predicate) {
+    case PFW_PREDICATE_IS:
+    case PFW_PREDICATE_ISNOT:
+        sweep->left[i] = rule->state.v;
+        sweep->span[i] = 0;
+        break;
+
+    case PFW_PREDICATE_INCLUDES:
+    case PFW_PREDICATE_EXCLUDES:
+        /* Any masked bit set, i.e. (state & mask) != 0. */
+
+        sweep->mask[i] = rule->state.v;
+        sweep->left[i] = 1;
+        sweep->span[i] = UINT32_MAX - 1;
+        break;
+
+    case PFW_PREDICATE_INCLUDESALL:
+        sweep->mask[i] = rule->state.v;
+        sweep->left[i] = rule->state.v;
+        sweep->span[i] = 0;
+        break;
+
+    case PFW_PREDICATE_INSET:
+        pfw_sweep_range(rule->state.v, &sweep->left[i], &sweep->span[i]);
+        break;
+
+    case PFW_PREDICATE_IN:
+    case PFW_PREDICATE_NOTIN:
+        itv = rule->state.itv;
+        if (itv->left <= itv->right) {
+            sweep->left[i] = itv->left;
+            sweep->span[i] = (uint32_t)itv->right - (uint32_t)itv->left;
+        } else {
+            sweep->mask[i] = 0;
+            sweep->left[i] = 1;
+            sweep->span[i] = 0;
+        }
+        break;
+    }
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * @brief Number all leaves and build the sweep evaluator.
+ * @note Call before compiling programs, they refer to leaf numbers.
+ */
+bool pfw_sweep_build(pfw_system_t* system)
+{
+    pfw_sweep_t* sweep;
+    pfw_domain_t* domain;
+    pfw_config_t* config;
+    int i, j, nb = 0;
+
+    for (i = 0; (domain = pfw_vector_get(system->domains, i)); i++) {
+        for (j = 0; (config = pfw_vector_get(domain->configs, j)); j++)
+            nb = pfw_sweep_number(config->rules, nb);
+    }
+
+    sweep = calloc(1, sizeof(pfw_sweep_t));
+    if (!sweep)
+        return false;
+
+    system->sweep = sweep;
+    sweep->nb = nb;
+    sweep->nb_states = pfw_vector_count(system->criteria);
+    sweep->index = malloc(nb * sizeof(uint32_t));
+    sweep->mask = malloc(nb * sizeof(uint32_t));
+    sweep->left = malloc(nb * sizeof(uint32_t));
+    sweep->span = malloc(nb * sizeof(uint32_t));
+    sweep->neg = malloc(nb);
+    sweep->results = malloc(nb);
+    sweep->states = malloc(sweep->nb_states * sizeof(int32_t));
+
+    /* malloc(0) may return NULL, nothing is read from empty arrays. */
+
+    if ((nb
+            && (!sweep->index || !sweep->mask || !sweep->left || !sweep->span
+                || !sweep->neg || !sweep->results))
+        || (sweep->nb_states && !sweep->states))
+        return false;
+
+    for (i = 0; (domain = pfw_vector_get(system->domains, i)); i++) {
+        for (j = 0; (config = pfw_vector_get(domain->configs, j)); j++)
+            pfw_sweep_fill(sweep, config->rules);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Evaluate all leaves, return results indexed by leaf number.
+ */
+const uint8_t* pfw_sweep_run(pfw_system_t* system)
+{
+    pfw_sweep_t* sweep = system->sweep;
+    pfw_criterion_t* criterion;
+    uint32_t x;
+    int i;
+
+    for (i = 0; i < sweep->nb_states; i++) {
+        criterion = pfw_vector_get(system->criteria, i);
+        sweep->states[i] = criterion->state;
+    }
+
+    for (i = 0; i < sweep->nb; i++) {
+        x = (uint32_t)sweep->states[sweep->index[i]] & sweep->mask[i];
+        sweep->results[i] = (x - sweep->left[i] <= sweep->span[i]) ^ sweep->neg[i];
+    }
+
+    return sweep->results;
+}
+
+void pfw_sweep_free(pfw_sweep_t* sweep)
+{
+    if (sweep) {
+        free(sweep->index);
+        free(sweep->mask);
+        free(sweep->left);
+        free(sweep->span);
+        free(sweep->neg);
+        free(sweep->results);
+        free(sweep->states);
+        free(sweep);
+    }
+}
@@ -28,6 +28,29 @@
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+/* Applies between two branch reorders in PFW_MODE_PROFILE. */
+
+#define PFW_PROFILE_PERIOD 64
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+/**
+ * @brief pfw_pending_t is an act deferred to the end of apply.
+ */
+typedef struct pfw_pending_s {
+    pfw_act_t* act;
+    const char* param;
+    char* copy; // Owned param, NULL if param is memoized.
+    struct pfw_pending_s* next; // Same param, other plugin.
+} pfw_pending_t;
 
 /****************************************************************************
  * Private Functions
@@ -39,7 +62,7 @@ static void pfw_free_plugins(pfw_system_t* system)
     int i;
 
     for (i = 0; (plugin = pfw_vector_get(system->plugins, i)); i++) {
-        free(plugin->parameter);
+        free(plugin->owned);
         free(plugin->name);
         free(plugin);
     }
@@ -48,34 +71,22 @@ static void pfw_free_plugins(pfw_system_t* system)
 }
 
 /**
- * @brief Convert ammends to string.
+ * @brief Drop acts deferred by PFW_MODE_DEDUP without delivering them.
  */
-static void pfw_apply_ammends(pfw_vector_t* ammends, char* res, int len)
+static void pfw_free_pending(pfw_system_t* system)
 {
-    pfw_criterion_t* criterion;
-    pfw_ammend_t* ammend;
-    int pos = 0, ret, i;
-
-    for (i = 0; (ammend = pfw_vector_get(ammends, i)); i++) {
-        criterion = ammend->u.criterion;
-
-        if (ammend->type == PFW_AMMEND_RAW) {
-            ret = snprintf(res + pos, len - pos, "%s", ammend->u.raw);
-        } else if (ammend->u.criterion->type == PFW_CRITERION_NUMERICAL) {
-            ret = snprintf(res + pos, len - pos, "%" PRId32, criterion->state);
-        } else {
-            ret = pfw_criterion_itoa(criterion, criterion->state,
-                res + pos, len - pos);
-        }
-
-        if (ret < 0)
-            return;
-
-        pos += ret;
+    pfw_pending_t* pending;
+    int i;
 
-        if (pos >= len)
-            return;
+    for (i = 0; (pending = pfw_vector_get(system->pending, i)); i++) {
+        free(pending->copy);
+        free(pending);
     }
+
+    pfw_vector_free(system->pending);
+    pfw_hash_free(system->deferred);
+    system->pending = NULL;
+    system->deferred = NULL;
 }
 
 /**
@@ -91,7 +102,7 @@ static bool pfw_apply_need(pfw_domain_t* domain, pfw_config_t* config)
         apply = true;
     }
 
-    pfw_apply_ammends(config->name, buffer, sizeof(buffer));
+    pfw_template_render(config->tmpl, buffer, sizeof(buffer));
     if (apply || !config->current || strcmp(config->current, buffer)) {
         free(config->current);
         config->current = strdup(buffer);
@@ -101,20 +112,392 @@ static bool pfw_apply_need(pfw_domain_t* domain, pfw_config_t* config)
     return false;
 }
 
+/**
+ * @brief Check wether gate of domain is open.
+ */
+static bool pfw_apply_open(pfw_gate_t* gate)
+{
+    pfw_domain_t* parent;
+
+    if (!gate)
+        return true;
+
+    if (gate->program)
+        return pfw_program_run(gate->program, NULL);
+
+    parent = gate->parent.p;
+    return parent->current && !strcmp(parent->current->current, gate->config);
+}
+
+/**
+ * @brief Call plugin of act with rendered param, unless it repeats the
+ * last one and plugin skips that.
+ * @param copy Whether param needs a copy to outlive the call.
+ */
+static void pfw_apply_deliver(pfw_act_t* act, const char* param, bool copy)
+{
+    pfw_plugin_t* plugin = act->plugin.p;
+    const pfw_command_t* commands;
+    int nb;
+
+    /* Memoized params are equal by address. */
+
+    if ((plugin->flags & PFW_PLUGIN_SKIP_SAME) && plugin->parameter
+        && (param == plugin->parameter || !strcmp(param, plugin->parameter)))
+        return;
+
+    if (plugin->argv) {
+        commands = pfw_template_args(act->tmpl, &nb);
+        plugin->argv(plugin->cookie, commands, nb);
+    } else {
+        plugin->cb(plugin->cookie, param);
+    }
+
+    if (copy) {
+        free(plugin->owned);
+        plugin->owned = strdup(param);
+        param = plugin->owned;
+    }
+
+    plugin->parameter = param;
+}
+
+/**
+ * @brief Index pending act by param, growing the index when full.
+ */
+static int pfw_apply_index(pfw_system_t* system, pfw_pending_t* pending)
+{
+    pfw_pending_t* other;
+    pfw_hash_t* hash;
+    int i, ret;
+
+    ret = pfw_hash_insert(system->deferred, pending->param, pending);
+    if (ret != -EINVAL && ret != -ENOSPC)
+        return ret;
+
+    /* Not created yet or full, rebuild twice as large. */
+
+    hash = pfw_hash_create(2 * pfw_vector_count(system->pending));
+    if (!hash)
+        return -ENOMEM;
+
+    /* Heads come first in pending, chained acts only return -EEXIST. */
+
+    for (i = 0; (other = pfw_vector_get(system->pending, i)); i++)
+        pfw_hash_insert(hash, other->param, other);
+
+    pfw_hash_free(system->deferred);
+    system->deferred = hash;
+    return 0;
+}
+
+/**
+ * @brief Defer act, unless the same plugin already has the same param.
+ */
+static void pfw_apply_defer(pfw_system_t* system, pfw_act_t* act,
+    const char* param, bool copy)
+{
+    pfw_pending_t *pending, *first;
+
+    first = pfw_hash_find(system->deferred, param);
+    for (pending = first; pending; pending = pending->next) {
+        if (pending->act->plugin.p == act->plugin.p)
+            return;
+    }
+
+    pending = calloc(1, sizeof(pfw_pending_t));
+    if (!pending)
+        goto err;
+
+    pending->act = act;
+    pending->param = param;
+    if (copy) {
+        pending->copy = strdup(param);
+        pending->param = pending->copy;
+        if (!pending->copy)
+            goto err;
+    }
+
+    if (pfw_vector_append(&system->pending, pending) < 0)
+        goto err;
+
+    if (first) {
+        pending->next = first->next;
+        first->next = pending;
+    } else {
+
+        /* Unindexed act is still delivered, only later repeats are. */
+
+        pfw_apply_index(system, pending);
+    }
+
+    return;
+
+err:
+
+    /* Out of memory, deliver now rather than lose the act. */
+
+    if (pending)
+        free(pending->copy);
+
+    free(pending);
+    pfw_apply_deliver(act, param, copy);
+}
+
+/**
+ * @brief Deliver the acts deferred by PFW_MODE_DEDUP, in first occurrence
+ * order.
+ */
+static void pfw_apply_flush(pfw_system_t* system)
+{
+    pfw_pending_t* pending;
+    int i;
+
+    for (i = 0; (pending = pfw_vector_get(system->pending, i)); i++)
+        pfw_apply_deliver(pending->act, pending->param, pending->copy != NULL);
+
+    pfw_free_pending(system);
+}
+
 /**
  * @brief Apply paramter to plugin callback.
  */
-static void pfw_apply_acts(pfw_vector_t* action)
+static void pfw_apply_acts(pfw_system_t* system, pfw_vector_t* action)
 {
     char buffer[PFW_MAXLEN_AMMENDS];
+    const char* param;
     pfw_act_t* act;
     int i;
 
     for (i = 0; (act = pfw_vector_get(action, i)); i++) {
-        pfw_apply_ammends(act->param, buffer, sizeof(buffer));
-        act->plugin.p->cb(act->plugin.p->cookie, buffer);
-        free(act->plugin.p->parameter);
-        act->plugin.p->parameter = strdup(buffer);
+        param = pfw_template_string(act->tmpl, buffer, sizeof(buffer));
+
+        /* Memoized string stays valid, only buffer needs a copy. */
+
+        if (system->mode & PFW_MODE_DEDUP)
+            pfw_apply_defer(system, act, param, param == buffer);
+        else
+            pfw_apply_deliver(act, param, param == buffer);
+    }
+}
+
+static uint64_t pfw_apply_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Select the config of dirty domain with an open gate, and apply
+ * it if it changes.
+ */
+static void pfw_apply_domain_locked(pfw_system_t* system,
+    pfw_domain_t* domain, const uint8_t* results, bool ready)
+{
+    pfw_domain_t* child;
+    pfw_config_t* config;
+    int i;
+
+    domain->dirty = false;
+    if (ready)
+        config = domain->selected;
+    else if (system->mode & PFW_MODE_PROFILE)
+        config = pfw_profile_select(domain);
+    else
+        config = pfw_domain_select(domain, results);
+
+    if (config && pfw_apply_need(domain, config)) {
+        syslog(LOG_INFO, "pfw domain:%s switch to conf:%s\n", domain->name, config->current);
+        pfw_apply_acts(system, config->acts);
+
+        /* Children come later, so they see the new config. */
+
+        for (i = 0; (child = pfw_vector_get(domain->children, i)); i++)
+            child->dirty = true;
+    }
+}
+
+/**
+ * @brief Evaluate dirty domains by priority from cursor on, within budget.
+ * @return index in pfw_system_t::order of the first domain left for
+ * later, 0 if none.
+ */
+static int pfw_apply_domains(pfw_system_t* system, int cursor,
+    int max_domains, uint64_t deadline)
+{
+    const uint8_t* results = NULL;
+    pfw_domain_t* domain;
+    int i, nb = 0, next = 0;
+    bool ready;
+
+    /* A new pass, domains dirtied later are left for the next one. */
+
+    if (cursor == 0) {
+        if (!system->dirty)
+            return 0;
+
+        system->dirty = false;
+    }
+
+    if (system->mode & PFW_MODE_SWEEP)
+        results = pfw_sweep_run(system);
+
+    /* Profile counters are not shared, budgets stop early. */
+
+    if (system->pool && !(system->mode & PFW_MODE_PROFILE) && max_domains <= 0
+        && !deadline)
+        pfw_pool_select(system->pool, system, cursor, results);
+
+    for (i = cursor; (domain = pfw_vector_get(system->order, i)); i++) {
+        if (!domain->dirty)
+            continue;
+
+        ready = domain->ready;
+        domain->ready = false;
+
+        /* Closed domain stays dirty until its gate opens. */
+
+        if (!pfw_apply_open(domain->gate))
+            continue;
+
+        if (nb > 0
+            && ((max_domains > 0 && nb >= max_domains)
+                || (deadline && pfw_apply_now() >= deadline))) {
+            next = i;
+            break;
+        }
+
+        nb++;
+        pfw_apply_domain_locked(system, domain, results, ready);
+    }
+
+    pfw_apply_flush(system);
+    if (next > 0)
+        return next;
+
+    if ((system->mode & PFW_MODE_PROFILE)
+        && ++system->applies >= PFW_PROFILE_PERIOD) {
+        system->applies = 0;
+        pfw_profile_reorder(system);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Evaluate dirty domains of set, or of priority at least priority
+ * if set is NULL, leaving the others dirty for the next pfw_apply().
+ */
+static void pfw_apply_some(pfw_system_t* system, pfw_domain_t** set, int nb,
+    int priority)
+{
+    pfw_domain_t* domain;
+    int i, j;
+
+    for (i = 0; (domain = pfw_vector_get(system->order, i)); i++) {
+        if (!set && domain->priority < priority)
+            break;
+
+        for (j = 0; j < nb && set[j] != domain; j++)
+            ;
+
+        if (set && j == nb)
+            continue;
+
+        if (domain->dirty && pfw_apply_open(domain->gate))
+            pfw_apply_domain_locked(system, domain, NULL, false);
+    }
+
+    pfw_apply_flush(system);
+}
+
+/**
+ * @brief Resolve override value, '+' or '-' before InclusiveCriterion
+ * literal includes or excludes it from the current state.
+ */
+static int pfw_preview_state(pfw_criterion_t* criterion, const char* value,
+    int32_t* state)
+{
+    int32_t mask;
+
+    if (criterion->type == PFW_CRITERION_INCLUSIVE
+        && (value[0] == '+' || value[0] == '-')) {
+        if (pfw_criterion_atoi(criterion, value + 1, &mask) < 0)
+            return -EINVAL;
+
+        if (value[0] == '+')
+            *state = criterion->state | mask;
+        else
+            *state = criterion->state & ~mask;
+
+        return 0;
+    }
+
+    if (pfw_criterion_atoi(criterion, value, state) < 0
+        || !pfw_criterion_check(criterion, *state))
+        return -EINVAL;
+
+    return 0;
+}
+
+/**
+ * @brief Same as pfw_apply_open(), parents being previewed as well.
+ */
+static bool pfw_preview_open(pfw_system_t* system, pfw_domain_t* domain,
+    pfw_config_t** selected)
+{
+    char buffer[PFW_MAXLEN_AMMENDS];
+    pfw_gate_t* gate = domain->gate;
+    pfw_domain_t* parent;
+    int i;
+
+    if (!gate || gate->program)
+        return pfw_apply_open(gate);
+
+    for (i = 0; (parent = pfw_vector_get(system->domains, i)); i++) {
+        if (parent == gate->parent.p)
+            break;
+    }
+
+    /* Parent keeping its config is in its current one. */
+
+    if (!selected[i])
+        return pfw_apply_open(gate);
+
+    pfw_template_render(selected[i]->tmpl, buffer, sizeof(buffer));
+    return !strcmp(buffer, gate->config);
+}
+
+/**
+ * @brief Report the config selected by every domain, and its acts.
+ */
+static void pfw_preview_report(pfw_system_t* system, pfw_config_t** selected,
+    pfw_preview_t on_act, void* cookie)
+{
+    char name[PFW_MAXLEN_AMMENDS], param[PFW_MAXLEN_AMMENDS];
+    pfw_domain_t* domain;
+    pfw_config_t* config;
+    pfw_act_t* act;
+    int i, j;
+
+    for (i = 0; (domain = pfw_vector_get(system->domains, i)); i++) {
+        config = selected[i];
+        if (!config) {
+            on_act(cookie, domain->name,
+                domain->current ? domain->current->current : NULL, NULL, NULL);
+            continue;
+        }
+
+        pfw_template_render(config->tmpl, name, sizeof(name));
+        for (j = 0; (act = pfw_vector_get(config->acts, j)); j++) {
+            pfw_template_render(act->tmpl, param, sizeof(param));
+            on_act(cookie, domain->name, name, act->plugin.p->name, param);
+        }
+
+        if (j == 0)
+            on_act(cookie, domain->name, name, NULL, NULL);
     }
 }
 
@@ -124,30 +507,247 @@ static void pfw_apply_acts(pfw_vector_t* action)
 
 /**
  * @brief Apply criteria changes to domains.
+ *
+ * Only domains depending on criteria modified since the last apply
+ * are re-evaluated.
  */
 void pfw_apply(void* handle)
 {
     pfw_system_t* system = handle;
-    pfw_domain_t* domain;
-    pfw_config_t* config;
-    int i, j;
 
     if (!system)
         return;
 
     pthread_mutex_lock(&system->mutex);
-    for (i = 0; (domain = pfw_vector_get(system->domains, i)); i++) {
-        for (j = 0; (config = pfw_vector_get(domain->configs, j)); j++) {
-            if (pfw_rule_match(config->rules)) {
-                if (pfw_apply_need(domain, config)) {
-                    syslog(LOG_INFO, "pfw domain:%s switch to conf:%s\n", domain->name, config->current);
-                    pfw_apply_acts(config->acts);
-                }
-                break;
-            }
+    pfw_apply_domains(system, 0, 0, 0);
+    pthread_mutex_unlock(&system->mutex);
+}
+
+/**
+ * @brief Same as pfw_apply(), stopping once max_domains domains are
+ * evaluated or max_us microseconds are spent, 0 for no limit.
+ *
+ * At least one domain is evaluated per call, so every call makes
+ * progress. Criteria may change between calls, domains not reached yet
+ * see the new states and the others are evaluated by the next pass.
+ *
+ * @param cursor 0 to start a pass, else the value of the previous call.
+ * @return cursor to resume from, 0 once the pass is complete, or
+ * negative errno.
+ */
+int pfw_apply_budget(void* handle, int cursor, int max_domains, int max_us)
+{
+    pfw_system_t* system = handle;
+    uint64_t deadline = 0;
+    int ret;
+
+    if (!system || cursor < 0 || cursor > pfw_vector_count(system->order))
+        return -EINVAL;
+
+    if (max_us > 0)
+        deadline = pfw_apply_now() + max_us;
+
+    pthread_mutex_lock(&system->mutex);
+    ret = pfw_apply_domains(system, cursor, max_domains, deadline);
+    pthread_mutex_unlock(&system->mutex);
+
+    return ret;
+}
+
+/**
+ * @brief Apply only the named domains, in priority order.
+ *
+ * Other dirty domains are left for the next pfw_apply(), including the
+ * ones gated by these domains.
+ *
+ * @return 0 on success, -EINVAL if some domain is unknown.
+ */
+int pfw_apply_group(void* handle, const char* const* names, int nb)
+{
+    pfw_system_t* system = handle;
+    pfw_domain_t** set;
+    int i, ret = 0;
+
+    if (!system || nb <= 0 || !names)
+        return -EINVAL;
+
+    set = calloc(nb, sizeof(pfw_domain_t*));
+    if (!set)
+        return -ENOMEM;
+
+    for (i = 0; i < nb; i++) {
+        set[i] = pfw_hash_find(system->domain_index, names[i]);
+        if (!set[i]) {
+            ret = -EINVAL;
+            goto out;
         }
     }
+
+    pthread_mutex_lock(&system->mutex);
+    pfw_apply_some(system, set, nb, 0);
     pthread_mutex_unlock(&system->mutex);
+
+out:
+    free(set);
+    return ret;
+}
+
+int pfw_apply_domain(void* handle, const char* name)
+{
+    return pfw_apply_group(handle, &name, 1);
+}
+
+/**
+ * @brief Apply only domains whose priority is at least priority.
+ */
+void pfw_apply_priority(void* handle, int priority)
+{
+    pfw_system_t* system = handle;
+
+    if (!system)
+        return;
+
+    pthread_mutex_lock(&system->mutex);
+    pfw_apply_some(system, NULL, 0, priority);
+    pthread_mutex_unlock(&system->mutex);
+}
+
+/**
+ * @brief Report what pfw_apply() would do with some criteria overridden.
+ *
+ * Overrides are stored while the system is locked and restored before
+ * returning, so no domain, listener, plugin or save callback sees them.
+ * on_act is called once per act of the config each domain would select,
+ * also with the system locked. Domains whose gate is closed, or where no
+ * config matches, keep their config: they are reported once with the
+ * current config and NULL plugin, as are selected configs without acts.
+ *
+ * @return 0 on success, negative errno if some override is invalid.
+ */
+int pfw_preview(void* handle, const pfw_override_t* overrides, int nb,
+    pfw_preview_t on_act, void* cookie)
+{
+    pfw_system_t* system = handle;
+    pfw_criterion_t **criteria, *criterion;
+    pfw_config_t** selected;
+    pfw_domain_t* domain;
+    int32_t *saved, *derived, state;
+    int i, n, ret = 0;
+
+    if (!system || (nb > 0 && !overrides) || nb < 0 || !on_act)
+        return -EINVAL;
+
+    criteria = calloc(nb + 1, sizeof(pfw_criterion_t*));
+    saved = calloc(nb + 1, sizeof(int32_t));
+    derived = calloc(pfw_vector_count(system->criteria) + 1, sizeof(int32_t));
+    selected = calloc(pfw_vector_count(system->domains) + 1,
+        sizeof(pfw_config_t*));
+    if (!criteria || !saved || !derived || !selected) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    for (i = 0; i < nb; i++) {
+        criteria[i] = pfw_criteria_find(system, overrides[i].name);
+        if (!criteria[i] || !overrides[i].value) {
+            ret = -EINVAL;
+            goto out;
+        }
+
+        if (criteria[i]->formula) {
+            ret = -EPERM;
+            goto out;
+        }
+    }
+
+    pthread_mutex_lock(&system->mutex);
+    for (n = 0; n < nb; n++) {
+        saved[n] = criteria[n]->state;
+        ret = pfw_preview_state(criteria[n], overrides[n].value, &state);
+        if (ret < 0)
+            break;
+
+        pfw_criterion_store(criteria[n], state);
+    }
+
+    /* Derived criteria follow their inputs in file order. */
+
+    for (i = 0; (criterion = pfw_vector_get(system->criteria, i)); i++) {
+        derived[i] = criterion->state;
+        if (ret == 0 && criterion->formula)
+            pfw_criterion_store(criterion, pfw_criterion_derive(criterion));
+    }
+
+    if (ret == 0) {
+        for (i = 0; (domain = pfw_vector_get(system->domains, i)); i++) {
+            if (pfw_preview_open(system, domain, selected))
+                selected[i] = pfw_domain_select(domain, NULL);
+        }
+
+        pfw_preview_report(system, selected, on_act, cookie);
+    }
+
+    for (i = 0; (criterion = pfw_vector_get(system->criteria, i)); i++) {
+        if (criterion->formula)
+            pfw_criterion_store(criterion, derived[i]);
+    }
+
+    /* Restore backwards, in case a criterion is overridden twice. */
+
+    while (n-- > 0)
+        pfw_criterion_store(criteria[n], saved[n]);
+
+    pthread_mutex_unlock(&system->mutex);
+
+out:
+    free(criteria);
+    free(saved);
+    free(derived);
+    free(selected);
+    return ret;
+}
+
+/**
+ * @brief Select configs of dirty domains with nb workers besides the
+ * caller of pfw_apply(), 0 to go back to sequential selection.
+ *
+ * Acts are still applied in domain order by the caller.
+ */
+int pfw_set_workers(void* handle, int nb)
+{
+    pfw_system_t* system = handle;
+    pfw_pool_t* pool = NULL;
+
+    if (!system || nb < 0)
+        return -EINVAL;
+
+    if (nb > 0) {
+        pool = pfw_pool_create(nb, pfw_vector_count(system->domains));
+        if (!pool)
+            return -ENOMEM;
+    }
+
+    pthread_mutex_lock(&system->mutex);
+    pfw_pool_destroy(system->pool);
+    system->pool = pool;
+    pthread_mutex_unlock(&system->mutex);
+
+    return 0;
+}
+
+int pfw_setmode(void* handle, int mode)
+{
+    pfw_system_t* system = handle;
+
+    if (!system
+        || (mode & ~(PFW_MODE_SWEEP | PFW_MODE_PROFILE | PFW_MODE_DEDUP)))
+        return -EINVAL;
+
+    pthread_mutex_lock(&system->mutex);
+    system->mode = mode;
+    pthread_mutex_unlock(&system->mutex);
+
+    return 0;
 }
 
 void* pfw_plugin_register(pfw_system_t* system, pfw_plugin_def_t* def)
@@ -163,8 +763,11 @@ void* pfw_plugin_register(pfw_system_t* system, pfw_plugin_def_t* def)
         return NULL;
 
     plugin->parameter = NULL;
+    plugin->owned = NULL;
     plugin->cookie = def->cookie;
     plugin->cb = def->cb;
+    plugin->argv = def->argv;
+    plugin->flags = def->flags;
     plugin->name = strdup(def->name);
     if (!plugin->name)
         goto err1;
@@ -223,12 +826,23 @@ void* pfw_create(const char* criteria, const char* settings,
     if (!system->settings_ctx)
         goto err;
 
-    if (pfw_parse_settings(system->settings_ctx, &system->domains) < 0)
+    if (pfw_parse_settings(system->settings_ctx, &system->domains,
+            &system->conditions)
+        < 0)
         goto err;
 
     if (!pfw_sanitize_settings(system))
         goto err;
 
+    if (!pfw_optimize_settings(system))
+        goto err;
+
+    if (!pfw_compile_settings(system))
+        goto err;
+
+    if (!pfw_reach_settings(system))
+        goto err;
+
     return system;
 
 err:
@@ -246,7 +860,14 @@ void pfw_destroy(void* handle, pfw_release_t on_release)
         pfw_context_destroy(system->criteria_ctx);
         pfw_context_destroy(system->settings_ctx);
         pfw_free_criteria(system->criteria);
-        pfw_free_settings(system->domains);
+        pfw_hash_free(system->index);
+        pfw_hash_free(system->domain_index);
+        pfw_vector_free(system->order);
+        free(system->packed);
+        pfw_sweep_free(system->sweep);
+        pfw_pool_destroy(system->pool);
+        pfw_free_pending(system);
+        pfw_free_settings(system->domains, system->conditions);
         pfw_free_plugins(system);
         pthread_mutex_destroy(&system->mutex);
         free(system);
@@ -0,0 +1,348 @@
+/****************************************************************************
+ * pfw/table.c
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.  The
+ * ASF licenses this file to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ ****************************************************************************/
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include "internal.h"
+#include <stdlib.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define PFW_TABLE_MAX_INPUTS 8
+#define PFW_TABLE_MAX_SIZE 1024
+#define PFW_TABLE_NONE 0xff // No config matches.
+#define PFW_TABLE_MISS -2 // State is out of table, evaluate configs.
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+/**
+ * @brief pfw_table_input_t is one digit of the table index.
+ *
+ * ExclusiveCriterion uses its state as digit; InclusiveCriterion packs
+ * the bits referenced by rules, other bits never change the result.
+ */
+typedef struct pfw_table_input_s {
+    pfw_criterion_t* criterion;
+    uint32_t mask; // Referenced bits, InclusiveCriterion only.
+    uint32_t radix;
+    uint32_t stride;
+} pfw_table_input_t;
+
+/**
+ * @brief pfw_table_t maps the states of criteria referenced by a domain
+ * to the index of its winning config.
+ */
+struct pfw_table_s {
+    int nb;
+    pfw_table_input_t inputs[PFW_TABLE_MAX_INPUTS];
+    uint32_t size;
+    uint8_t entries[];
+};
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static int pfw_table_popcount(uint32_t mask)
+{
+    int nb = 0;
+
+    for (; mask; mask &= mask - 1)
+        nb++;
+
+    return nb;
+}
+
+/**
+ * @brief All bits of InclusiveCriterion.
+ */
+static uint32_t pfw_table_all(pfw_criterion_t* criterion)
+{
+    int nb = pfw_vector_count(criterion->ranges);
+
+    return nb >= 32 ? ~0u : (1u << nb) - 1;
+}
+
+/**
+ * @brief Collect criteria referenced by rule, false if not tabulable.
+ */
+static bool pfw_table_collect(pfw_table_t* table, pfw_rule_t* rule)
+{
+    pfw_table_input_t* input;
+    pfw_rule_t* sub;
+    int i;
+
+    if (!rule)
+        return true;
+
+    switch (rule->predicate) {
+    case PFW_PREDICATE_ALL:
+    case PFW_PREDICATE_ANY:
+        for (i = 0; (sub = pfw_vector_get(rule->branches, i)); i++) {
+            if (!pfw_table_collect(table, sub))
+                return false;
+        }
+
+        return true;
+
+    case PFW_PREDICATE_COND:
+        return pfw_table_collect(table, rule->state.cond->rules);
+    }
+
+    if (rule->criterion.p->type == PFW_CRITERION_NUMERICAL)
+        return false;
+
+    for (i = 0; i < table->nb; i++) {
+        if (table->inputs[i].criterion == rule->criterion.p)
+            break;
+    }
+
+    if (i == PFW_TABLE_MAX_INPUTS)
+        return false;
+
+    input = &table->inputs[i];
+    if (i == table->nb) {
+        input->criterion = rule->criterion.p;
+        table->nb++;
+    }
+
+    if (rule->criterion.p->type != PFW_CRITERION_INCLUSIVE)
+        return true;
+
+    /* Bit predicates read their bits only, In/NotIn the whole state. */
+
+    switch (rule->predicate) {
+    case PFW_PREDICATE_INCLUDES:
+    case PFW_PREDICATE_EXCLUDES:
+    case PFW_PREDICATE_INCLUDESALL:
+        input->mask |= rule->state.v;
+        break;
+
+    default:
+        input->mask |= pfw_table_all(rule->criterion.p);
+        break;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Extract the referenced bits of state into a dense digit.
+ */
+static uint32_t pfw_table_pack(uint32_t state, uint32_t mask)
+{
+    uint32_t digit = 0;
+    int bit;
+
+    for (bit = 0; mask; mask &= mask - 1, bit++) {
+        if (state & mask & -mask)
+            digit |= 1u << bit;
+    }
+
+    return digit;
+}
+
+/**
+ * @brief Scatter a dense digit back to the referenced bits.
+ */
+static uint32_t pfw_table_unpack(uint32_t digit, uint32_t mask)
+{
+    uint32_t state = 0;
+    int bit;
+
+    for (bit = 0; mask; mask &= mask - 1, bit++) {
+        if (digit & (1u << bit))
+            state |= mask & -mask;
+    }
+
+    return state;
+}
+
+/**
+ * @brief Evaluate configs for every combination of input states.
+ */
+static void pfw_table_fill(pfw_table_t* table, pfw_domain_t* domain)
+{
+    int32_t saved[PFW_TABLE_MAX_INPUTS];
+    pfw_table_input_t* input;
+    pfw_config_t* config;
+    uint32_t idx, digit;
+    int i;
+
+    for (i = 0; i < table->nb; i++)
+        saved[i] = table->inputs[i].criterion->state;
+
+    for (idx = 0; idx < table->size; idx++) {
+        for (i = 0; i < table->nb; i++) {
+            input = &table->inputs[i];
+            digit = idx / input->stride % input->radix;
+            if (input->criterion->type == PFW_CRITERION_INCLUSIVE)
+                digit = pfw_table_unpack(digit, input->mask);
+
+            pfw_criterion_store(input->criterion, digit);
+        }
+
+        table->entries[idx] = PFW_TABLE_NONE;
+        for (i = 0; (config = pfw_vector_get(domain->configs, i)); i++) {
+            if (pfw_program_run(config->program, NULL)) {
+                table->entries[idx] = i;
+                break;
+            }
+        }
+    }
+
+    for (i = 0; i < table->nb; i++)
+        pfw_criterion_store(table->inputs[i].criterion, saved[i]);
+}
+
+/**
+ * @brief Lookup the winning config index.
+ * @return index, -1 if no config matches, PFW_TABLE_MISS if some state
+ * is out of the table.
+ */
+static int pfw_table_lookup(pfw_table_t* table)
+{
+    pfw_table_input_t* input;
+    uint32_t idx = 0, digit;
+    int i;
+
+    for (i = 0; i < table->nb; i++) {
+        input = &table->inputs[i];
+        if (input->mask)
+            digit = pfw_table_pack(input->criterion->state, input->mask);
+        else
+            digit = input->criterion->state;
+
+        if (digit >= input->radix)
+            return PFW_TABLE_MISS;
+
+        idx += digit * input->stride;
+    }
+
+    return table->entries[idx] == PFW_TABLE_NONE ? -1 : table->entries[idx];
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * @brief Build decision table for domain with a small state space.
+ * @return false only if out of memory; domains that don't fit keep
+ * evaluating configs one by one.
+ */
+bool pfw_table_build(pfw_domain_t* domain)
+{
+    pfw_table_t tmp = { 0 }, *table;
+    pfw_table_input_t* input;
+    pfw_config_t* config;
+    uint32_t size = 1;
+    int i;
+
+    if (pfw_vector_count(domain->configs) >= PFW_TABLE_NONE)
+        return true;
+
+    for (i = 0; (config = pfw_vector_get(domain->configs, i)); i++) {
+        if (!pfw_table_collect(&tmp, config->rules))
+            return true;
+    }
+
+    for (i = 0; i < tmp.nb; i++) {
+        input = &tmp.inputs[i];
+        if (input->criterion->type == PFW_CRITERION_INCLUSIVE) {
+            if (pfw_table_popcount(input->mask) >= 32)
+                return true;
+
+            input->radix = 1u << pfw_table_popcount(input->mask);
+        } else
+            input->radix = pfw_vector_count(input->criterion->ranges);
+
+        input->stride = size;
+        if (input->radix > PFW_TABLE_MAX_SIZE / size)
+            return true;
+
+        size *= input->radix;
+    }
+
+    table = malloc(sizeof(pfw_table_t) + size);
+    if (!table)
+        return false;
+
+    *table = tmp;
+    table->size = size;
+    pfw_table_fill(table, domain);
+    domain->table = table;
+    return true;
+}
+
+/**
+ * @brief Mark reached[i + 1] for every config index i the table selects,
+ * reached[0] if some states select none.
+ */
+void pfw_table_reach(pfw_table_t* table, bool* reached)
+{
+    uint32_t idx;
+
+    for (idx = 0; idx < table->size; idx++) {
+        if (table->entries[idx] == PFW_TABLE_NONE)
+            reached[0] = true;
+        else
+            reached[table->entries[idx] + 1] = true;
+    }
+}
+
+void pfw_table_free(pfw_table_t* table)
+{
+    free(table);
+}
+
+/**
+ * @brief Select the config domain shall switch to, NULL if none.
+ * @param results Leaf results by pfw_sweep_run(), or NULL.
+ */
+pfw_config_t* pfw_domain_select(pfw_domain_t* domain,
+    const uint8_t* results)
+{
+    pfw_config_t* config;
+    int i;
+
+    if (domain->table) {
+        i = pfw_table_lookup(domain->table);
+        if (i != PFW_TABLE_MISS)
+            return pfw_vector_get(domain->configs, i);
+    }
+
+    if (domain->bisect)
+        return pfw_vector_get(domain->configs,
+            pfw_bisect_lookup(domain->bisect));
+
+    for (i = 0; (config = pfw_vector_get(domain->configs, i)); i++) {
+        if (pfw_program_run(config->program, results))
+            return config;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,527 @@
+/****************************************************************************
+ * pfw/template.c
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.  The
+ * ASF licenses this file to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ ****************************************************************************/
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include "internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define PFW_TEMPLATE_MAXLEN_INT 12 // "-2147483648"
+#define PFW_TEMPLATE_MAXLEN_NUM 32 // Result of expression.
+#define PFW_TEMPLATE_MAX_CACHE 256 // Most states memoized per template.
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+/**
+ * @brief pfw_template_part_t is one ammend with its raw length known.
+ */
+typedef struct pfw_template_part_s {
+    int type; // @see PFW_AMMEND_*
+    int len; // Length of raw string, PFW_AMMEND_RAW only.
+    union {
+        const char* raw;
+        pfw_criterion_t* criterion;
+        pfw_expr_t* expr;
+    } u;
+} pfw_template_part_t;
+
+/**
+ * @brief pfw_template_field_t is the pieces rendered into one field.
+ */
+typedef struct pfw_template_field_s {
+    int first;
+    int nb; // 0 if field is constant.
+} pfw_template_field_t;
+
+/**
+ * @brief pfw_template_split_t is a template split into commands and
+ * fields, for plugins taking pfw_argv_t.
+ */
+typedef struct pfw_template_split_s {
+    int nb_commands;
+    pfw_command_t* commands;
+    pfw_arg_t* args;
+    pfw_template_field_t* fields;
+    int nb_fields;
+    pfw_template_part_t* pieces; // Parts cut at separators.
+    char scratch[PFW_MAXLEN_AMMENDS]; // Rendered fields.
+} pfw_template_split_t;
+
+/**
+ * @brief pfw_template_t is a vector of ammends compiled for rendering.
+ *
+ * Template reading at most one criterion with few states memoizes its
+ * rendered string per state, filled on first use, so expressions are
+ * evaluated once per state.
+ */
+struct pfw_template_s {
+    pfw_criterion_t* key; // Only criterion read, NULL if none.
+    int32_t base; // State of cache[0].
+    int span; // Size of cache, 0 if not memoized.
+    char** cache;
+    pfw_template_split_t* split;
+    int nb;
+    pfw_template_part_t parts[];
+};
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+/**
+ * @brief Format v in decimal at the end of buf.
+ * @return start of digits, buf holds at least PFW_TEMPLATE_MAXLEN_INT.
+ */
+static char* pfw_template_itoa(int32_t v, char* buf)
+{
+    char* p = buf + PFW_TEMPLATE_MAXLEN_INT;
+    uint32_t u = v < 0 ? -(uint32_t)v : (uint32_t)v;
+
+    do {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u);
+
+    if (v < 0)
+        *--p = '-';
+
+    return p;
+}
+
+/**
+ * @brief Format result of expression, integers without fraction.
+ * @return start of text, n set to its length.
+ */
+static const char* pfw_template_ftoa(double v, char* buf, int* n)
+{
+    const char* p;
+
+    if (v >= INT32_MIN && v <= INT32_MAX && v == (int32_t)v) {
+        p = pfw_template_itoa(v, buf);
+        *n = buf + PFW_TEMPLATE_MAXLEN_INT - p;
+        return p;
+    }
+
+    *n = snprintf(buf, PFW_TEMPLATE_MAXLEN_NUM, "%.6g", v);
+    return buf;
+}
+
+/**
+ * @brief Record that template reads criterion.
+ * @return 1 if it is another criterion than the one read before.
+ */
+static int pfw_template_key(pfw_template_t* tmpl, pfw_criterion_t* criterion)
+{
+    int other = tmpl->key && tmpl->key != criterion;
+
+    tmpl->key = criterion;
+    return other;
+}
+
+/**
+ * @brief Find the states of key criterion worth memoizing.
+ * @return number of states from base, 0 if too many.
+ */
+static int pfw_template_span(pfw_criterion_t* key, int32_t* base)
+{
+    pfw_interval_t* itv;
+    int64_t lo = 0, hi = 0;
+    int i, nb;
+
+    *base = 0;
+    if (!key)
+        return 1;
+
+    nb = pfw_vector_count(key->ranges);
+    switch (key->type) {
+    case PFW_CRITERION_EXCLUSIVE:
+        return nb <= PFW_TEMPLATE_MAX_CACHE ? nb : 0;
+
+    case PFW_CRITERION_INCLUSIVE:
+        return nb < 31 && (1 << nb) <= PFW_TEMPLATE_MAX_CACHE ? 1 << nb : 0;
+    }
+
+    for (i = 0; (itv = pfw_vector_get(key->ranges, i)); i++) {
+        if (i == 0 || itv->left < lo)
+            lo = itv->left;
+        if (i == 0 || itv->right > hi)
+            hi = itv->right;
+    }
+
+    if (nb == 0 || hi - lo + 1 > PFW_TEMPLATE_MAX_CACHE)
+        return 0;
+
+    *base = lo;
+    return hi - lo + 1;
+}
+
+/**
+ * @brief Render nb parts into res, truncated to len - 1 characters like
+ * snprintf().
+ * @return length of res.
+ */
+static int pfw_template_put(const pfw_template_part_t* parts, int nb,
+    char* res, int len)
+{
+    char digits[PFW_TEMPLATE_MAXLEN_NUM];
+    const pfw_template_part_t* part;
+    pfw_criterion_t* criterion;
+    const char* src;
+    int pos = 0, n, i;
+
+    for (i = 0; i < nb && pos < len - 1; i++) {
+        part = &parts[i];
+        if (part->type == PFW_AMMEND_RAW) {
+            src = part->u.raw;
+            n = part->len;
+        } else if (part->type == PFW_AMMEND_EXPR) {
+            src = pfw_template_ftoa(pfw_expr_eval(part->u.expr), digits, &n);
+        } else if (part->u.criterion->type == PFW_CRITERION_NUMERICAL) {
+            criterion = part->u.criterion;
+            src = pfw_template_itoa(criterion->state, digits);
+            n = digits + PFW_TEMPLATE_MAXLEN_INT - src;
+        } else {
+            criterion = part->u.criterion;
+            n = pfw_criterion_itoa(criterion, criterion->state, res + pos,
+                len - pos);
+            if (n < 0)
+                break;
+
+            pos += n < len - pos ? n : len - pos - 1;
+            continue;
+        }
+
+        if (n > len - 1 - pos)
+            n = len - 1 - pos;
+
+        memcpy(res + pos, src, n);
+        pos += n;
+    }
+
+    res[pos] = '\0';
+    return pos;
+}
+
+/**
+ * @brief Close field of pieces from first on, and command if last.
+ */
+static void pfw_template_close(pfw_template_split_t* split, int* first,
+    int nb_pieces, int* command, bool last)
+{
+    pfw_template_field_t* field = &split->fields[split->nb_fields];
+
+    field->first = *first;
+    field->nb = nb_pieces - *first;
+    split->nb_fields++;
+    *first = nb_pieces;
+    if (!last)
+        return;
+
+    /* Drop empty command, like the one after a trailing ';'. */
+
+    if (split->nb_fields - *command == 1 && field->nb == 0) {
+        split->nb_fields--;
+        return;
+    }
+
+    split->commands[split->nb_commands].argc = split->nb_fields - *command;
+    split->commands[split->nb_commands].argv = &split->args[*command];
+    split->nb_commands++;
+    *command = split->nb_fields;
+}
+
+/**
+ * @brief Type field, constant fields are rendered once.
+ * @return false only if out of memory.
+ */
+static bool pfw_template_type(pfw_template_split_t* split, int i)
+{
+    pfw_template_field_t* field = &split->fields[i];
+    pfw_template_part_t* piece = &split->pieces[field->first];
+    pfw_arg_t* arg = &split->args[i];
+    char *str, *end;
+    int j, len = 0;
+
+    for (j = 0; j < field->nb; j++) {
+        if (piece[j].type != PFW_AMMEND_RAW)
+            break;
+
+        len += piece[j].len;
+    }
+
+    if (j < field->nb) {
+        arg->is_int = field->nb == 1 && piece->type == PFW_AMMEND_CRITERION
+            && piece->u.criterion->type == PFW_CRITERION_NUMERICAL;
+        return true;
+    }
+
+    str = malloc(len + 1);
+    if (!str)
+        return false;
+
+    pfw_template_put(piece, field->nb, str, len + 1);
+    arg->str = str;
+    arg->value = strtol(str, &end, 10);
+    arg->is_int = len > 0 && *end == '\0';
+    field->nb = 0;
+    return true;
+}
+
+/**
+ * @brief Free split template, constant fields own their string.
+ */
+static void pfw_template_unsplit(pfw_template_split_t* split)
+{
+    int i;
+
+    if (!split)
+        return;
+
+    for (i = 0; split->fields && i < split->nb_fields; i++) {
+        if (split->fields[i].nb == 0)
+            free((char*)split->args[i].str);
+    }
+
+    free(split->commands);
+    free(split->args);
+    free(split->fields);
+    free(split->pieces);
+    free(split);
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/**
+ * @brief Compile sanitized ammends into template.
+ * @return template, NULL if out of memory.
+ */
+pfw_template_t* pfw_template_compile(pfw_vector_t* ammends)
+{
+    pfw_criterion_t* criterion;
+    pfw_template_t* tmpl;
+    pfw_ammend_t* ammend;
+    int i, j, nb, keys = 0;
+
+    nb = pfw_vector_count(ammends);
+    tmpl = malloc(sizeof(pfw_template_t) + nb * sizeof(pfw_template_part_t));
+    if (!tmpl)
+        return NULL;
+
+    tmpl->key = NULL;
+    tmpl->cache = NULL;
+    tmpl->split = NULL;
+    tmpl->nb = nb;
+    for (i = 0; (ammend = pfw_vector_get(ammends, i)); i++) {
+        tmpl->parts[i].type = ammend->type;
+        tmpl->parts[i].u.raw = ammend->u.raw;
+        if (ammend->type == PFW_AMMEND_RAW) {
+            tmpl->parts[i].len = strlen(ammend->u.raw);
+            continue;
+        }
+
+        if (ammend->type == PFW_AMMEND_EXPR) {
+            tmpl->parts[i].u.expr = ammend->expr;
+            for (j = 0; (criterion = pfw_expr_input(ammend->expr, j)); j++)
+                keys += pfw_template_key(tmpl, criterion);
+
+            continue;
+        }
+
+        tmpl->parts[i].u.criterion = ammend->u.criterion;
+        keys += pfw_template_key(tmpl, ammend->u.criterion);
+    }
+
+    tmpl->span = keys == 0 ? pfw_template_span(tmpl->key, &tmpl->base) : 0;
+    if (tmpl->span > 0) {
+        tmpl->cache = calloc(tmpl->span, sizeof(char*));
+        if (!tmpl->cache) {
+            free(tmpl);
+            return NULL;
+        }
+    }
+
+    return tmpl;
+}
+
+/**
+ * @brief Render template with current criteria states into res, truncated
+ * to len - 1 characters like snprintf().
+ * @return length of res.
+ */
+int pfw_template_render(pfw_template_t* tmpl, char* res, int len)
+{
+    return pfw_template_put(tmpl->parts, tmpl->nb, res, len);
+}
+
+/**
+ * @brief Get template rendered with current criteria states.
+ * @return memoized string that lives as long as template, or buf holding
+ * the rendered string if the state is not memoized.
+ */
+const char* pfw_template_string(pfw_template_t* tmpl, char* buf, int len)
+{
+    int64_t idx;
+    char** slot;
+
+    idx = tmpl->key ? (int64_t)tmpl->key->state - tmpl->base : 0;
+    if (idx < 0 || idx >= tmpl->span) {
+        pfw_template_render(tmpl, buf, len);
+        return buf;
+    }
+
+    slot = &tmpl->cache[idx];
+    if (!*slot) {
+        pfw_template_render(tmpl, buf, len);
+        *slot = strdup(buf);
+        if (!*slot)
+            return buf;
+    }
+
+    return *slot;
+}
+
+/**
+ * @brief Split template on ';' into commands and ',' into fields.
+ *
+ * Separators are searched in raw strings only, states of criteria are
+ * expected not to contain any.
+ *
+ * @return false only if out of memory.
+ */
+bool pfw_template_split(pfw_template_t* tmpl)
+{
+    pfw_template_split_t* split;
+    pfw_template_part_t* part;
+    int i, nb = 1, first = 0, command = 0, pieces = 0, len;
+    const char *p, *end;
+
+    for (i = 0; i < tmpl->nb; i++) {
+        if (tmpl->parts[i].type != PFW_AMMEND_RAW)
+            continue;
+
+        for (p = tmpl->parts[i].u.raw; *p; p++)
+            nb += *p == ',' || *p == ';';
+    }
+
+    split = calloc(1, sizeof(pfw_template_split_t));
+    if (!split)
+        return false;
+
+    tmpl->split = split;
+    split->commands = calloc(nb, sizeof(pfw_command_t));
+    split->args = calloc(nb, sizeof(pfw_arg_t));
+    split->fields = calloc(nb, sizeof(pfw_template_field_t));
+    split->pieces = calloc(nb + tmpl->nb, sizeof(pfw_template_part_t));
+    if (!split->commands || !split->args || !split->fields || !split->pieces)
+        return false;
+
+    for (i = 0; i < tmpl->nb; i++) {
+        part = &tmpl->parts[i];
+        if (part->type != PFW_AMMEND_RAW) {
+            split->pieces[pieces++] = *part;
+            continue;
+        }
+
+        for (p = part->u.raw;; p = end + 1) {
+            end = p + strcspn(p, ",;");
+            len = end - p;
+            if (len > 0) {
+                split->pieces[pieces].type = PFW_AMMEND_RAW;
+                split->pieces[pieces].u.raw = p;
+                split->pieces[pieces].len = len;
+                pieces++;
+            }
+
+            if (*end == '\0')
+                break;
+
+            pfw_template_close(split, &first, pieces, &command, *end == ';');
+        }
+    }
+
+    pfw_template_close(split, &first, pieces, &command, true);
+
+    for (i = 0; i < split->nb_fields; i++) {
+        if (!pfw_template_type(split, i))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Render the dynamic fields of split template.
+ * @return commands valid until next call, nb set to their number.
+ */
+const pfw_command_t* pfw_template_args(pfw_template_t* tmpl, int* nb)
+{
+    pfw_template_split_t* split = tmpl->split;
+    pfw_template_field_t* field;
+    pfw_arg_t* arg;
+    int i, pos = 0;
+
+    for (i = 0; i < split->nb_fields; i++) {
+        field = &split->fields[i];
+        if (field->nb == 0)
+            continue;
+
+        arg = &split->args[i];
+        arg->str = split->scratch + pos;
+        pos += pfw_template_put(&split->pieces[field->first], field->nb,
+                   split->scratch + pos, sizeof(split->scratch) - pos)
+            + 1;
+        if (pos >= (int)sizeof(split->scratch))
+            pos = sizeof(split->scratch) - 1;
+
+        if (arg->is_int)
+            arg->value = split->pieces[field->first].u.criterion->state;
+    }
+
+    *nb = split->nb_commands;
+    return split->commands;
+}
+
+void pfw_template_free(pfw_template_t* tmpl)
+{
+    int i;
+
+    if (!tmpl)
+        return;
+
+    pfw_template_unsplit(tmpl->split);
+
+    for (i = 0; i < tmpl->span; i++)
+        free(tmpl->cache[i]);
+
+    free(tmpl->cache);
+    free(tmpl);
+}
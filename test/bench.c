@@ -0,0 +1,228 @@
+/****************************************************************************
+ * pfw/test/bench.c
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.  The
+ * ASF licenses this file to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ ****************************************************************************/
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include "../internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define PFW_BENCH_ROUNDS 200000
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+typedef bool (*pfw_bench_match_t)(pfw_config_t* config);
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static void pfw_bench_callback(void* cookie, const char* params)
+{
+}
+
+static bool pfw_bench_tree(pfw_config_t* config)
+{
+    return pfw_rule_match(config->rules);
+}
+
+static bool pfw_bench_program(pfw_config_t* config)
+{
+    return pfw_program_run(config->program, NULL);
+}
+
+static uint64_t pfw_bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+ * @brief Move every criterion to a pseudo random valid state.
+ */
+static void pfw_bench_shuffle(pfw_system_t* system, unsigned seed)
+{
+    pfw_criterion_t* criterion;
+    pfw_interval_t* itv;
+    int i, nb;
+
+    for (i = 0; (criterion = pfw_vector_get(system->criteria, i)); i++) {
+        seed = seed * 1103515245u + 12345u;
+        nb = pfw_vector_count(criterion->ranges);
+
+        switch (criterion->type) {
+        case PFW_CRITERION_EXCLUSIVE:
+            pfw_criterion_store(criterion, (seed >> 16) % nb);
+            break;
+
+        case PFW_CRITERION_INCLUSIVE:
+            pfw_criterion_store(criterion,
+                (seed >> 8) & (nb >= 32 ? ~0u : (1u << nb) - 1));
+            break;
+
+        case PFW_CRITERION_NUMERICAL:
+            itv = pfw_vector_get(criterion->ranges, 0);
+            if (itv->right - itv->left < 64)
+                pfw_criterion_store(criterion, itv->left
+                    + (seed >> 16) % (itv->right - itv->left + 1));
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Select a config in every domain, like pfw_apply() does.
+ */
+static uint64_t pfw_bench_select(pfw_system_t* system,
+    pfw_bench_match_t match, pfw_config_t** res)
+{
+    pfw_domain_t* domain;
+    pfw_config_t* config;
+    uint64_t start;
+    int i, j;
+
+    start = pfw_bench_now();
+    for (i = 0; (domain = pfw_vector_get(system->domains, i)); i++) {
+        res[i] = NULL;
+        for (j = 0; (config = pfw_vector_get(domain->configs, j)); j++) {
+            if (match(config)) {
+                res[i] = config;
+                break;
+            }
+        }
+    }
+
+    return pfw_bench_now() - start;
+}
+
+/**
+ * @brief Select a config in every domain through decision tables.
+ */
+static uint64_t pfw_bench_select_domain(pfw_system_t* system,
+    pfw_config_t** res)
+{
+    pfw_domain_t* domain;
+    uint64_t start;
+    int i;
+
+    start = pfw_bench_now();
+    for (i = 0; (domain = pfw_vector_get(system->domains, i)); i++)
+        res[i] = pfw_domain_select(domain, NULL);
+
+    return pfw_bench_now() - start;
+}
+
+/**
+ * @brief Select a config in every domain from sweep results only.
+ */
+static uint64_t pfw_bench_select_sweep(pfw_system_t* system,
+    pfw_config_t** res)
+{
+    const uint8_t* results;
+    pfw_domain_t* domain;
+    pfw_config_t* config;
+    uint64_t start;
+    int i, j;
+
+    start = pfw_bench_now();
+    results = pfw_sweep_run(system);
+    for (i = 0; (domain = pfw_vector_get(system->domains, i)); i++) {
+        res[i] = NULL;
+        for (j = 0; (config = pfw_vector_get(domain->configs, j)); j++) {
+            if (pfw_program_run(config->program, results)) {
+                res[i] = config;
+                break;
+            }
+        }
+    }
+
+    return pfw_bench_now() - start;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+int main(int argc, char* argv[])
+{
+    pfw_plugin_def_t plugins[] = {
+        { "FFmpegCommand", NULL, pfw_bench_callback },
+        { "SetParameter", NULL, pfw_bench_callback }
+    };
+    const char* criteria = argc > 2 ? argv[1] : "./criteria.txt";
+    const char* settings = argc > 2 ? argv[2] : "./settings.pfw";
+    pfw_config_t **res1, **res2, **res3, **res4;
+    uint64_t tree = 0, program = 0, table = 0, sweep = 0;
+    pfw_system_t* system;
+    int i, j, nb;
+
+    system = pfw_create(criteria, settings, plugins,
+        sizeof(plugins) / sizeof(plugins[0]), NULL, NULL, NULL);
+    if (!system) {
+        printf("create failed\n");
+        return 1;
+    }
+
+    nb = pfw_vector_count(system->domains);
+    res1 = calloc(nb, sizeof(pfw_config_t*));
+    res2 = calloc(nb, sizeof(pfw_config_t*));
+    res3 = calloc(nb, sizeof(pfw_config_t*));
+    res4 = calloc(nb, sizeof(pfw_config_t*));
+
+    for (i = 0; i < PFW_BENCH_ROUNDS; i++) {
+        pfw_bench_shuffle(system, i);
+        tree += pfw_bench_select(system, pfw_bench_tree, res1);
+        program += pfw_bench_select(system, pfw_bench_program, res2);
+        table += pfw_bench_select_domain(system, res3);
+        sweep += pfw_bench_select_sweep(system, res4);
+
+        for (j = 0; j < nb; j++) {
+            if (res1[j] != res2[j] || res1[j] != res3[j]
+                || res1[j] != res4[j]) {
+                printf("mismatch at round %d domain %d\n", i, j);
+                return 1;
+            }
+        }
+    }
+
+    printf("%d rounds over %d domains\n", PFW_BENCH_ROUNDS, nb);
+    printf("tree    %8.1f ns/round\n", (double)tree / PFW_BENCH_ROUNDS);
+    printf("program %8.1f ns/round\n", (double)program / PFW_BENCH_ROUNDS);
+    printf("table   %8.1f ns/round\n", (double)table / PFW_BENCH_ROUNDS);
+    printf("sweep   %8.1f ns/round\n", (double)sweep / PFW_BENCH_ROUNDS);
+
+    free(res1);
+    free(res2);
+    free(res3);
+    free(res4);
+    pfw_destroy(system, NULL);
+    return 0;
+}
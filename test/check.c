@@ -0,0 +1,1981 @@
+/****************************************************************************
+ * pfw/test/check.c
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.  The
+ * ASF licenses this file to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ ****************************************************************************/
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include "../internal.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define PFW_CHECK_CRITERIA "./check_criteria.txt"
+#define PFW_CHECK_SETTINGS "./check_settings.pfw"
+#define PFW_CHECK_ROUNDS 4096 // States sampled when there are more.
+#define PFW_CHECK_MAX_VALUES 64 // Values tried per criterion.
+#define PFW_CHECK_WIDE 130 // 32-bit criteria filling 65 packed words.
+#define PFW_CHECK_MAX_LOG 64
+#define PFW_CHECK_MAXLEN_LOG 64
+#define PFW_CHECK_APPLY_ROUNDS 512
+#define PFW_CHECK_EXPR_DEPTH 32 // Evaluation stack of expr.c.
+#define PFW_CHECK_MAXLEN_JOINED 256
+#define PFW_CHECK_MAX_OVERRIDES 4
+#define PFW_CHECK_MAX_STATES 8 // Criteria and domains of preview check.
+
+/* Ways of selecting configs of the created system. */
+
+#define PFW_CHECK_TREE 0 // Rule trees of the created system.
+#define PFW_CHECK_PROGRAM 1 // Compiled programs.
+#define PFW_CHECK_SWEEP 2 // Compiled programs on sweep results.
+#define PFW_CHECK_INDEX 3 // Decision table or interval index first.
+#define PFW_CHECK_PATHS 4
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+/**
+ * @brief pfw_check_snapshot_t is what pfw_preview() must leave unchanged.
+ */
+typedef struct pfw_check_snapshot_s {
+    int32_t states[PFW_CHECK_MAX_STATES];
+    bool dirty[PFW_CHECK_MAX_STATES];
+    bool system_dirty;
+} pfw_check_snapshot_t;
+
+/**
+ * @brief pfw_check_case_t is a pair of configuration files.
+ */
+typedef struct pfw_check_case_s {
+    const char* name;
+    const char* criteria;
+    const char* settings;
+} pfw_check_case_t;
+
+/**
+ * @brief pfw_check_values_t is the states tried for one criterion.
+ */
+typedef struct pfw_check_values_s {
+    int nb;
+    int32_t v[PFW_CHECK_MAX_VALUES];
+} pfw_check_values_t;
+
+/**
+ * @brief pfw_check_log_t records the params delivered to a plugin.
+ */
+typedef struct pfw_check_log_s {
+    int nb;
+    char entries[PFW_CHECK_MAX_LOG][PFW_CHECK_MAXLEN_LOG];
+} pfw_check_log_t;
+
+/**
+ * @brief pfw_check_apply_t is a way of applying, compared with a plain
+ * pfw_apply().
+ */
+typedef struct pfw_check_apply_s {
+    const char* name;
+    int mode; // @see PFW_MODE_*
+    int budget; // Domains per pfw_apply_budget() call, 0 for pfw_apply().
+    int workers; // @see pfw_set_workers()
+} pfw_check_apply_t;
+
+/****************************************************************************
+ * Private Function Prototypes
+ ****************************************************************************/
+
+static void pfw_check_callback(void* cookie, const char* params);
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+static const char* g_pfw_check_paths[PFW_CHECK_PATHS] = {
+    "tree", "program", "sweep", "index"
+};
+
+static const pfw_check_apply_t g_pfw_check_applies[] = {
+    { "sweep", PFW_MODE_SWEEP, 0, 0 },
+    { "profile", PFW_MODE_PROFILE, 0, 0 },
+    { "sweep+profile", PFW_MODE_SWEEP | PFW_MODE_PROFILE, 0, 0 },
+    { "budget", 0, 1, 0 },
+    { "budget+sweep", PFW_MODE_SWEEP, 2, 0 },
+    { "workers", 0, 0, 2 },
+    { "workers+sweep", PFW_MODE_SWEEP, 0, 2 },
+};
+
+#define PFW_CHECK_NB_APPLIES \
+    (int)(sizeof(g_pfw_check_applies) / sizeof(g_pfw_check_applies[0]))
+
+static pfw_plugin_def_t g_pfw_check_plugins[] = {
+    { "FFmpegCommand", NULL, pfw_check_callback },
+    { "SetParameter", NULL, pfw_check_callback },
+    { "CommandArgv", NULL, pfw_check_callback },
+    { "Set", NULL, pfw_check_callback },
+};
+
+#define PFW_CHECK_NB_PLUGINS \
+    (int)(sizeof(g_pfw_check_plugins) / sizeof(g_pfw_check_plugins[0]))
+
+static const pfw_check_case_t g_pfw_check_cases[] = {
+    {
+        "inclusive-in",
+        "InclusiveCriterion UsingDevices : mic sco usb\n"
+        "ExclusiveCriterion AudioMode : normal phone ringtone\n",
+        "domain: Devices\n"
+        "\tconf: few\n"
+        "\t\tUsingDevices In [0,1]\n"
+        "\t\tSet = few\n"
+        "\tconf: mic\n"
+        "\t\tALL\n"
+        "\t\t\tUsingDevices Includes mic\n"
+        "\t\t\tAudioMode NotIn [1,1]\n"
+        "\t\tSet = mic\n"
+        "\tconf: other\n"
+        "\t\tALL\n"
+        "\t\tSet = other\n",
+    },
+    {
+        "includes-none",
+        "InclusiveCriterion UsingDevices : mic sco\n"
+        "ExclusiveCriterion AudioMode : normal phone ringtone\n",
+        "domain: Empty\n"
+        "\tconf: none\n"
+        "\t\tALL\n"
+        "\t\t\tUsingDevices Includes <none>\n"
+        "\t\t\tAudioMode Is normal\n"
+        "\t\tSet = none\n"
+        "\tconf: first\n"
+        "\t\tALL\n"
+        "\t\t\tAudioMode Includes normal\n"
+        "\t\t\tUsingDevices Excludes <none>\n"
+        "\t\tSet = first\n"
+        "\tconf: fallback\n"
+        "\t\tALL\n"
+        "\t\tSet = fallback\n",
+    },
+    {
+        "merged-any",
+        "InclusiveCriterion AvailableDevices : a2dp sco\n"
+        "ExclusiveCriterion AudioMode : normal phone ringtone\n",
+        "domain: Merged\n"
+        "\tconf: c0\n"
+        "\t\tANY\n"
+        "\t\t\tAvailableDevices Includes a2dp\n"
+        "\t\t\tAvailableDevices Includes sco\n"
+        "\t\t\tAudioMode Is phone\n"
+        "\t\tSet = c0\n",
+    },
+    {
+        "aliases",
+        "InclusiveCriterion UsingDevices : mic sco usb\n",
+        "domain: Aliases\n"
+        "\tconf: any\n"
+        "\t\tUsingDevices IncludesAny mic|sco\n"
+        "\t\tSet = any\n"
+        "\tconf: none\n"
+        "\t\tUsingDevices ExcludesAll mic|usb\n"
+        "\t\tSet = none\n"
+        "\tconf: other\n"
+        "\t\tALL\n"
+        "\t\tSet = other\n",
+    },
+    {
+        "intervals",
+        "NumericalCriterion Volume : [0,10] = 5\n",
+        "domain: Intervals\n"
+        "\tconf: low\n"
+        "\t\tVolume In [0,3]\n"
+        "\t\tSet = low\n"
+        "\tconf: high\n"
+        "\t\tANY\n"
+        "\t\t\tVolume In [8,10]\n"
+        "\t\t\tVolume In [12,20]\n"
+        "\t\tSet = high\n"
+        "\tconf: above\n"
+        "\t\tVolume NotIn [,10]\n"
+        "\t\tSet = above\n"
+        "\tconf: middle\n"
+        "\t\tALL\n"
+        "\t\tSet = middle\n",
+    },
+    {
+        "merged-all",
+        "InclusiveCriterion UsingDevices : mic sco\n",
+        "domain: Merged\n"
+        "\tconf: none\n"
+        "\t\tALL\n"
+        "\t\t\tUsingDevices Includes <none>\n"
+        "\t\t\tUsingDevices Includes mic\n"
+        "\t\tSet = none\n"
+        "\tconf: both\n"
+        "\t\tALL\n"
+        "\t\t\tUsingDevices Includes mic\n"
+        "\t\t\tUsingDevices Includes sco\n"
+        "\t\tSet = both\n"
+        "\tconf: other\n"
+        "\t\tALL\n"
+        "\t\tSet = other\n",
+    },
+};
+
+/* Settings that must fail to load. */
+
+static const pfw_check_case_t g_pfw_check_rejects[] = {
+    {
+        "exclusive-includesall",
+        "ExclusiveCriterion AudioMode : normal phone ringtone\n",
+        "domain: Mode\n"
+        "\tconf: phone\n"
+        "\t\tAudioMode IncludesAll phone\n"
+        "\t\tSet = phone\n",
+    },
+    {
+        "exclusive-includesany",
+        "ExclusiveCriterion AudioMode : normal phone ringtone\n",
+        "domain: Mode\n"
+        "\tconf: phone\n"
+        "\t\tAudioMode IncludesAny phone\n"
+        "\t\tSet = phone\n",
+    },
+    {
+        "exclusive-excludesall",
+        "ExclusiveCriterion AudioMode : normal phone ringtone\n",
+        "domain: Mode\n"
+        "\tconf: phone\n"
+        "\t\tAudioMode ExcludesAll phone\n"
+        "\t\tSet = phone\n",
+    },
+    {
+        "exclusive-set",
+        "ExclusiveCriterion AudioMode : normal phone ringtone\n",
+        "domain: Mode\n"
+        "\tconf: phone\n"
+        "\t\tAudioMode Includes {phone,ringtone}\n"
+        "\t\tSet = phone\n",
+    },
+    {
+        "gate-forward",
+        "ExclusiveCriterion AudioMode : normal phone ringtone\n",
+        "domain: Child\n"
+        "\tgate: Parent phone\n"
+        "\tconf: any\n"
+        "\t\tALL\n"
+        "\t\tSet = child\n"
+        "domain: Parent\n"
+        "\tconf: phone\n"
+        "\t\tAudioMode Is phone\n"
+        "\t\tSet = phone\n"
+        "\tconf: other\n"
+        "\t\tALL\n"
+        "\t\tSet = other\n",
+    },
+};
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static void pfw_check_callback(void* cookie, const char* params)
+{
+}
+
+static void pfw_check_record(void* cookie, const char* params)
+{
+    pfw_check_log_t* log = cookie;
+
+    if (log->nb < PFW_CHECK_MAX_LOG)
+        snprintf(log->entries[log->nb++], PFW_CHECK_MAXLEN_LOG, "%s", params);
+}
+
+/**
+ * @brief Record commands joined back into a string in cookie[0], and with
+ * int typed fields marked by '#' in cookie[1].
+ */
+static void pfw_check_record_argv(void* cookie,
+    const pfw_command_t* commands, int nb)
+{
+    pfw_check_log_t* logs = cookie;
+    char joined[PFW_CHECK_MAXLEN_LOG], typed[PFW_CHECK_MAXLEN_LOG];
+    char value[16];
+    const pfw_arg_t* arg;
+    const char* sep;
+    int i, j, n = 0, t = 0;
+
+    for (i = 0; i < nb; i++) {
+        for (j = 0; j < commands[i].argc; j++) {
+            arg = &commands[i].argv[j];
+            sep = j ? "," : i ? ";" : "";
+
+            /* Int field reading otherwise than its string shows as '?'. */
+
+            snprintf(value, sizeof(value), "%" PRId32, arg->value);
+            n += snprintf(joined + n, sizeof(joined) - n, "%s%s", sep,
+                arg->str);
+            t += snprintf(typed + t, sizeof(typed) - t, "%s%s%s", sep,
+                arg->is_int ? "#" : "",
+                arg->is_int && strcmp(value, arg->str) ? "?" : arg->str);
+            n = n < (int)sizeof(joined) ? n : (int)sizeof(joined) - 1;
+            t = t < (int)sizeof(typed) ? t : (int)sizeof(typed) - 1;
+        }
+    }
+
+    joined[n] = typed[t] = '\0';
+    pfw_check_record(&logs[0], joined);
+    pfw_check_record(&logs[1], typed);
+}
+
+/**
+ * @brief Join entries of log with '|', then clear it.
+ */
+static void pfw_check_join(pfw_check_log_t* log, char* joined)
+{
+    int i, n = 0;
+
+    joined[0] = '\0';
+    for (i = 0; i < log->nb && n < PFW_CHECK_MAXLEN_JOINED; i++)
+        n += snprintf(joined + n, PFW_CHECK_MAXLEN_JOINED - n, "%s%s",
+            i ? "|" : "", log->entries[i]);
+
+    log->nb = 0;
+}
+
+/**
+ * @brief Record "domain:config" once per domain previewed.
+ */
+static void pfw_check_record_preview(void* cookie, const char* domain,
+    const char* config, const char* plugin, const char* params)
+{
+    pfw_check_log_t* log = cookie;
+    char entry[PFW_CHECK_MAXLEN_LOG];
+
+    snprintf(entry, sizeof(entry), "%s:%s", domain, config ? config : "");
+    if (log->nb == 0 || strcmp(log->entries[log->nb - 1], entry))
+        pfw_check_record(log, entry);
+}
+
+static bool pfw_check_write(const char* path, const char* text)
+{
+    FILE* file;
+    bool ret;
+
+    file = fopen(path, "w");
+    if (!file)
+        return false;
+
+    ret = fputs(text, file) >= 0;
+    return fclose(file) == 0 && ret;
+}
+
+/**
+ * @brief Same as pfw_create(), keeping the rule trees as parsed.
+ */
+static pfw_system_t* pfw_check_reference(const char* criteria,
+    const char* settings)
+{
+    pfw_system_t* system;
+    int i;
+
+    system = calloc(1, sizeof(pfw_system_t));
+    if (!system)
+        return NULL;
+
+    pthread_mutex_init(&system->mutex, NULL);
+
+    for (i = 0; i < PFW_CHECK_NB_PLUGINS; i++) {
+        if (!pfw_plugin_register(system, &g_pfw_check_plugins[i]))
+            goto err;
+    }
+
+    system->criteria_ctx = pfw_context_create(criteria);
+    if (!system->criteria_ctx
+        || pfw_parse_criteria(system->criteria_ctx, &system->criteria) < 0
+        || !pfw_sanitize_criteria(system))
+        goto err;
+
+    system->settings_ctx = pfw_context_create(settings);
+    if (!system->settings_ctx
+        || pfw_parse_settings(system->settings_ctx, &system->domains,
+               &system->conditions)
+            < 0
+        || !pfw_sanitize_settings(system))
+        goto err;
+
+    return system;
+
+err:
+    pfw_destroy(system, NULL);
+    return NULL;
+}
+
+static void pfw_check_add(pfw_check_values_t* values, int64_t v)
+{
+    int i;
+
+    if (v < INT32_MIN)
+        v = INT32_MIN;
+    else if (v > INT32_MAX)
+        v = INT32_MAX;
+
+    for (i = 0; i < values->nb; i++) {
+        if (values->v[i] == v)
+            return;
+    }
+
+    if (values->nb < PFW_CHECK_MAX_VALUES)
+        values->v[values->nb++] = v;
+}
+
+/**
+ * @brief Add the states around every interval rule tests on criterion.
+ */
+static void pfw_check_bounds(pfw_rule_t* rule, pfw_criterion_t* criterion,
+    pfw_check_values_t* values)
+{
+    pfw_rule_t* sub;
+    int i;
+
+    if (!rule)
+        return;
+
+    switch (rule->predicate) {
+    case PFW_PREDICATE_ALL:
+    case PFW_PREDICATE_ANY:
+        for (i = 0; (sub = pfw_vector_get(rule->branches, i)); i++)
+            pfw_check_bounds(sub, criterion, values);
+
+        return;
+
+    case PFW_PREDICATE_IN:
+    case PFW_PREDICATE_NOTIN:
+        if (rule->criterion.p != criterion)
+            return;
+
+        pfw_check_add(values, (int64_t)rule->state.itv->left - 1);
+        pfw_check_add(values, rule->state.itv->left);
+        pfw_check_add(values, rule->state.itv->right);
+        pfw_check_add(values, (int64_t)rule->state.itv->right + 1);
+        return;
+    }
+}
+
+/**
+ * @brief Collect the states worth trying for criterion: all of them if
+ * few, else the bounds of its ranges and of the intervals tested.
+ */
+static void pfw_check_values(pfw_system_t* system,
+    pfw_criterion_t* criterion, pfw_check_values_t* values)
+{
+    pfw_condition_t* condition;
+    pfw_interval_t* itv;
+    pfw_domain_t* domain;
+    pfw_config_t* config;
+    uint32_t all;
+    int i, j, nb;
+
+    values->nb = 0;
+    nb = pfw_vector_count(criterion->ranges);
+
+    switch (criterion->type) {
+    case PFW_CRITERION_EXCLUSIVE:
+        for (i = 0; i < nb; i++)
+            pfw_check_add(values, i);
+        break;
+
+    case PFW_CRITERION_INCLUSIVE:
+        all = nb >= 32 ? ~0u : (1u << nb) - 1;
+        if (nb <= 5) {
+            for (i = 0; i <= (int)all; i++)
+                pfw_check_add(values, i);
+            break;
+        }
+
+        pfw_check_add(values, 0);
+        pfw_check_add(values, (int32_t)all);
+        for (i = 0; i < nb; i++) {
+            pfw_check_add(values, (int32_t)(1u << i));
+            pfw_check_add(values, (int32_t)(all & ~(1u << i)));
+        }
+        break;
+
+    case PFW_CRITERION_NUMERICAL:
+        for (i = 0; (itv = pfw_vector_get(criterion->ranges, i)); i++) {
+            pfw_check_add(values, itv->left);
+            pfw_check_add(values, itv->right);
+        }
+        break;
+    }
+
+    /* Intervals may also be tested on Exclusive/Inclusive states. */
+
+    for (i = 0; (condition = pfw_vector_get(system->conditions, i)); i++)
+        pfw_check_bounds(condition->rules, criterion, values);
+
+    for (i = 0; (domain = pfw_vector_get(system->domains, i)); i++) {
+        if (domain->gate)
+            pfw_check_bounds(domain->gate->rules, criterion, values);
+
+        for (j = 0; (config = pfw_vector_get(domain->configs, j)); j++)
+            pfw_check_bounds(config->rules, criterion, values);
+    }
+
+    /* Only NumericalCriterion can be set out of its ranges. */
+
+    if (criterion->type == PFW_CRITERION_NUMERICAL)
+        return;
+
+    for (i = j = 0; i < values->nb; i++) {
+        if (pfw_criterion_check(criterion, values->v[i]))
+            values->v[j++] = values->v[i];
+    }
+
+    values->nb = j;
+}
+
+/**
+ * @brief Store state of the index-th criterion in both systems.
+ */
+static void pfw_check_store(pfw_system_t* real, pfw_system_t* ref,
+    int index, int32_t state)
+{
+    pfw_criterion_store(pfw_vector_get(real->criteria, index), state);
+    pfw_criterion_store(pfw_vector_get(ref->criteria, index), state);
+}
+
+/**
+ * @brief Recompute derived criteria, inputs come first.
+ */
+static void pfw_check_derive(pfw_system_t* system)
+{
+    pfw_criterion_t* criterion;
+    int i;
+
+    for (i = 0; (criterion = pfw_vector_get(system->criteria, i)); i++) {
+        if (criterion->formula)
+            pfw_criterion_store(criterion, pfw_criterion_derive(criterion));
+    }
+}
+
+/**
+ * @brief Render config name for reports, criteria as '%name%'.
+ */
+static void pfw_check_name(pfw_config_t* config, char* res, int len)
+{
+    pfw_ammend_t* ammend;
+    int pos = 0, i;
+
+    if (!config) {
+        snprintf(res, len, "(none)");
+        return;
+    }
+
+    res[0] = '\0';
+    for (i = 0; (ammend = pfw_vector_get(config->name, i)) && pos < len;
+         i++) {
+        if (ammend->type == PFW_AMMEND_CRITERION)
+            pos += snprintf(res + pos, len - pos, "%%%s%%",
+                (char*)pfw_vector_get(ammend->u.criterion->names, 0));
+        else
+            pos += snprintf(res + pos, len - pos, "%s", ammend->u.raw);
+    }
+}
+
+/**
+ * @brief Select the config of domain the way path does.
+ */
+static pfw_config_t* pfw_check_select(pfw_domain_t* domain, int path,
+    const uint8_t* results)
+{
+    pfw_config_t* config;
+    bool match;
+    int i;
+
+    if (path == PFW_CHECK_INDEX)
+        return pfw_domain_select(domain, NULL);
+
+    for (i = 0; (config = pfw_vector_get(domain->configs, i)); i++) {
+        if (path == PFW_CHECK_TREE)
+            match = pfw_rule_match(config->rules);
+        else
+            match = pfw_program_run(config->program,
+                path == PFW_CHECK_SWEEP ? results : NULL);
+
+        if (match)
+            return config;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Compare every path of real with the parsed trees of ref, for
+ * the current states.
+ * @return number of mismatches.
+ */
+static int pfw_check_compare(const char* name, pfw_system_t* real,
+    pfw_system_t* ref)
+{
+    char expect[PFW_MAXLEN_AMMENDS], got[PFW_MAXLEN_AMMENDS];
+    pfw_criterion_t* criterion;
+    const uint8_t* results;
+    pfw_domain_t* domain;
+    int i, j, path, nb = 0;
+
+    pfw_check_derive(real);
+    pfw_check_derive(ref);
+    results = pfw_sweep_run(real);
+
+    for (i = 0; (domain = pfw_vector_get(real->domains, i)); i++) {
+        pfw_check_name(pfw_check_select(pfw_vector_get(ref->domains, i),
+                           PFW_CHECK_TREE, NULL),
+            expect, sizeof(expect));
+
+        for (path = 0; path < PFW_CHECK_PATHS; path++) {
+            pfw_check_name(pfw_check_select(domain, path, results), got,
+                sizeof(got));
+            if (!strcmp(expect, got))
+                continue;
+
+            printf("%s: domain '%s' %s selects '%s', expected '%s' at",
+                name, domain->name, g_pfw_check_paths[path], got, expect);
+            for (j = 0; (criterion = pfw_vector_get(ref->criteria, j)); j++)
+                printf(" %" PRId32, criterion->state);
+
+            printf("\n");
+            nb++;
+        }
+    }
+
+    return nb;
+}
+
+/**
+ * @brief Compare real with ref over all combinations of tried states,
+ * or over pseudo random ones if there are too many.
+ * @return number of mismatches.
+ */
+static int pfw_check_states(const char* name, pfw_system_t* real,
+    pfw_system_t* ref)
+{
+    pfw_check_values_t* values;
+    pfw_criterion_t* criterion;
+    uint64_t total = 1, round;
+    uint32_t seed;
+    int i, nb, failed = 0;
+
+    nb = pfw_vector_count(ref->criteria);
+    values = calloc(nb ? nb : 1, sizeof(pfw_check_values_t));
+    if (!values)
+        return 1;
+
+    for (i = 0; (criterion = pfw_vector_get(ref->criteria, i)); i++) {
+        if (criterion->formula)
+            continue;
+
+        pfw_check_values(ref, criterion, &values[i]);
+        if (total <= PFW_CHECK_ROUNDS)
+            total *= values[i].nb;
+    }
+
+    for (round = 0; round < PFW_CHECK_ROUNDS && !failed; round++) {
+        seed = round;
+        for (i = 0; i < nb; i++) {
+            if (values[i].nb == 0)
+                continue;
+
+            if (total <= PFW_CHECK_ROUNDS) {
+                pfw_check_store(real, ref, i, values[i].v[seed % values[i].nb]);
+                seed /= values[i].nb;
+            } else {
+                seed = seed * 1103515245u + 12345u;
+                pfw_check_store(real, ref, i,
+                    values[i].v[(seed >> 16) % values[i].nb]);
+            }
+        }
+
+        failed = pfw_check_compare(name, real, ref);
+        if (total <= PFW_CHECK_ROUNDS && round + 1 == total)
+            break;
+    }
+
+    free(values);
+    return failed;
+}
+
+/**
+ * @brief Create the system and its reference from the same files.
+ */
+static bool pfw_check_create(const char* name, const char* criteria,
+    const char* settings, pfw_system_t** real, pfw_system_t** ref)
+{
+    *real = pfw_create(criteria, settings, g_pfw_check_plugins,
+        PFW_CHECK_NB_PLUGINS, NULL, NULL, NULL);
+    *ref = pfw_check_reference(criteria, settings);
+    if (*real && *ref)
+        return true;
+
+    printf("%s: create failed\n", name);
+    pfw_destroy(*real, NULL);
+    pfw_destroy(*ref, NULL);
+    return false;
+}
+
+static int pfw_check_files(const char* name, const char* criteria,
+    const char* settings)
+{
+    pfw_system_t *real, *ref;
+    int failed;
+
+    if (!pfw_check_create(name, criteria, settings, &real, &ref))
+        return 1;
+
+    failed = pfw_check_states(name, real, ref);
+
+    pfw_destroy(real, NULL);
+    pfw_destroy(ref, NULL);
+    return failed;
+}
+
+static int pfw_check_case(const pfw_check_case_t* check)
+{
+    if (!pfw_check_write(PFW_CHECK_CRITERIA, check->criteria)
+        || !pfw_check_write(PFW_CHECK_SETTINGS, check->settings)) {
+        printf("%s: write failed\n", check->name);
+        return 1;
+    }
+
+    return pfw_check_files(check->name, PFW_CHECK_CRITERIA,
+        PFW_CHECK_SETTINGS);
+}
+
+/**
+ * @brief Settings of check must be refused while sanitizing.
+ */
+static int pfw_check_reject(const pfw_check_case_t* check)
+{
+    pfw_system_t* system;
+
+    if (!pfw_check_write(PFW_CHECK_CRITERIA, check->criteria)
+        || !pfw_check_write(PFW_CHECK_SETTINGS, check->settings)) {
+        printf("%s: write failed\n", check->name);
+        return 1;
+    }
+
+    system = pfw_check_reference(PFW_CHECK_CRITERIA, PFW_CHECK_SETTINGS);
+    if (!system)
+        return 0;
+
+    printf("%s: loaded, expected to be refused\n", check->name);
+    pfw_destroy(system, NULL);
+    return 1;
+}
+
+/**
+ * @brief ALL of leaves on more packed words than a word has bits, every
+ * leaf failing alone must make it false.
+ */
+static int pfw_check_wide(void)
+{
+    FILE *criteria, *settings;
+    pfw_system_t *real, *ref;
+    int i, j, failed;
+
+    criteria = fopen(PFW_CHECK_CRITERIA, "w");
+    settings = fopen(PFW_CHECK_SETTINGS, "w");
+    if (!criteria || !settings) {
+        printf("wide: write failed\n");
+        if (criteria)
+            fclose(criteria);
+        if (settings)
+            fclose(settings);
+        return 1;
+    }
+
+    fprintf(settings, "domain: Wide\n\tconf: all\n\t\tALL\n");
+    for (i = 0; i < PFW_CHECK_WIDE; i++) {
+        fprintf(criteria, "InclusiveCriterion Wide%d :", i);
+        for (j = 0; j < 32; j++)
+            fprintf(criteria, " b%d", j);
+
+        fprintf(criteria, "\n");
+        fprintf(settings, "\t\t\tWide%d Includes b0\n", i);
+    }
+
+    fprintf(settings, "\t\tSet = all\n\tconf: none\n\t\tALL\n"
+                      "\t\tSet = none\n");
+    fclose(criteria);
+    fclose(settings);
+
+    if (!pfw_check_create("wide", PFW_CHECK_CRITERIA, PFW_CHECK_SETTINGS,
+            &real, &ref))
+        return 1;
+
+    for (i = 0; i < PFW_CHECK_WIDE; i++)
+        pfw_check_store(real, ref, i, 1);
+
+    failed = pfw_check_compare("wide", real, ref);
+    for (i = 0; i < PFW_CHECK_WIDE && !failed; i++) {
+        pfw_check_store(real, ref, i, 0);
+        failed = pfw_check_compare("wide", real, ref);
+        pfw_check_store(real, ref, i, 1);
+    }
+
+    pfw_destroy(real, NULL);
+    pfw_destroy(ref, NULL);
+    return failed;
+}
+
+/**
+ * @brief Create system whose plugins all record to log.
+ */
+static void* pfw_check_open(const char* name, const char* criteria,
+    const char* settings, pfw_check_log_t* log)
+{
+    pfw_plugin_def_t defs[PFW_CHECK_NB_PLUGINS];
+    void* system;
+    int i;
+
+    for (i = 0; i < PFW_CHECK_NB_PLUGINS; i++) {
+        defs[i] = g_pfw_check_plugins[i];
+        defs[i].cookie = log;
+        defs[i].cb = pfw_check_record;
+    }
+
+    system = pfw_create(criteria, settings, defs, PFW_CHECK_NB_PLUGINS, NULL,
+        NULL, NULL);
+    if (!system)
+        printf("%s: create failed\n", name);
+
+    return system;
+}
+
+/**
+ * @brief Create system from case, its plugins recording to log.
+ */
+static void* pfw_check_logged(const pfw_check_case_t* check,
+    pfw_check_log_t* log)
+{
+    if (!pfw_check_write(PFW_CHECK_CRITERIA, check->criteria)
+        || !pfw_check_write(PFW_CHECK_SETTINGS, check->settings)) {
+        printf("%s: write failed\n", check->name);
+        return NULL;
+    }
+
+    return pfw_check_open(check->name, PFW_CHECK_CRITERIA,
+        PFW_CHECK_SETTINGS, log);
+}
+
+/**
+ * @brief NumericalCriterion set out of its ranges still selects configs
+ * matching such states.
+ */
+static int pfw_check_range(void)
+{
+    static const pfw_check_case_t check = {
+        "range",
+        "NumericalCriterion Volume : [0,10] = 5\n",
+        "domain: Range\n"
+        "\tconf: in\n"
+        "\t\tVolume In [0,10]\n"
+        "\t\tSet = in\n"
+        "\tconf: out\n"
+        "\t\tALL\n"
+        "\t\tSet = out\n",
+    };
+    pfw_check_log_t log = { 0 };
+    void* system;
+    int failed;
+
+    system = pfw_check_logged(&check, &log);
+    if (!system)
+        return 1;
+
+    pfw_apply(system);
+    log.nb = 0;
+    pfw_setstring(system, "Volume", "15");
+    pfw_apply(system);
+
+    failed = log.nb != 1 || strcmp(log.entries[0], "out");
+    if (failed)
+        printf("%s: state out of ranges applies '%s', expected 'out'\n",
+            check.name, log.nb ? log.entries[0] : "nothing");
+
+    pfw_destroy(system, NULL);
+    return failed;
+}
+
+/**
+ * @brief Derived criterion is clamped to its ranges, then rounded, even
+ * when the formula leaves the 32-bit range.
+ */
+static int pfw_check_derived(void)
+{
+    static const pfw_check_case_t check = {
+        "derived",
+        "NumericalCriterion Volume : [-10,10] = 0\n"
+        "DerivedCriterion Scaled : [-2147483648,2147483647] = "
+        "Volume * 2147483648 / 10\n",
+        "domain: Derived\n"
+        "\tconf: any\n"
+        "\t\tALL\n"
+        "\t\tSet = %Scaled%\n",
+    };
+    pfw_check_log_t log = { 0 };
+    int32_t expect;
+    void* system;
+    int v, got, failed = 0;
+    double x;
+
+    system = pfw_check_logged(&check, &log);
+    if (!system)
+        return 1;
+
+    for (v = -10; v <= 10 && !failed; v++) {
+        x = v * 2147483648.0 / 10;
+        if (x <= INT32_MIN)
+            expect = INT32_MIN;
+        else if (x >= INT32_MAX)
+            expect = INT32_MAX;
+        else
+            expect = round(x);
+
+        pfw_setint(system, "Volume", v);
+        failed = pfw_getint(system, "Scaled", &got) < 0 || got != expect;
+        if (failed)
+            printf("%s: Volume %d derives %d, expected %" PRId32 "\n",
+                check.name, v, got, expect);
+    }
+
+    pfw_destroy(system, NULL);
+    return failed;
+}
+
+/**
+ * @brief Remainder of derived criteria stays defined for NaN and operands
+ * beyond 64 bits, and rounds toward zero like C integers.
+ */
+static int pfw_check_modulo(void)
+{
+    static const pfw_check_case_t check = {
+        "modulo",
+        "NumericalCriterion Volume : [-10,10] = 0\n"
+        "DerivedCriterion Big : [-100,100] = Volume * pow(2, 63) % 7\n"
+        "DerivedCriterion Min : [-100,100] = Volume * pow(2, 63) % -1\n"
+        "DerivedCriterion Nan : [-100,100] = pow(Volume, 0.5) % 3\n"
+        "DerivedCriterion Half : [-100,100] = Volume / 2 % 3\n",
+        "domain: Modulo\n"
+        "\tconf: any\n"
+        "\t\tALL\n"
+        "\t\tSet = %Big%\n",
+    };
+    static const char* const names[] = { "Big", "Min", "Nan", "Half" };
+    pfw_check_log_t log = { 0 };
+    int expect[4];
+    void* system;
+    int v, i, got, failed = 0;
+
+    system = pfw_check_logged(&check, &log);
+    if (!system)
+        return 1;
+
+    for (v = -10; v <= 10 && !failed; v++) {
+
+        /* 2^63 is 1 modulo 7. */
+
+        expect[0] = v % 7;
+        expect[1] = 0;
+        expect[2] = v < 0 ? -100 : (int)sqrt(v) % 3;
+        expect[3] = v / 2 % 3;
+
+        pfw_setint(system, "Volume", v);
+        for (i = 0; i < 4 && !failed; i++) {
+            failed = pfw_getint(system, names[i], &got) < 0
+                || got != expect[i];
+            if (failed)
+                printf("%s: Volume %d derives %s %d, expected %d\n",
+                    check.name, v, names[i], got, expect[i]);
+        }
+    }
+
+    pfw_destroy(system, NULL);
+    return failed;
+}
+
+/**
+ * @brief Expressions in params follow the operator precedences, divide by
+ * zero as 0, and are refused past the depth of the evaluation stack.
+ */
+static int pfw_check_expr(void)
+{
+    static const char* const acts[][2] = {
+        { "%{1 + 2 * 3}%", "7" },
+        { "%{(1 + 2) * 3}%", "9" },
+        { "%{Volume - 2 - 1}%", "2" },
+        { "%{2 * Volume % 3}%", "1" },
+        { "%{-2 ^ 2}%", "-4" },
+        { "%{2 ^ 3 ^ 2}%", "512" },
+        { "%{1 || 0 && 0}%", "1" },
+        { "%{Volume > 4 == 1 ? 3 : 4}%", "3" },
+        { "%{Volume / 0}%", "0" },
+        { "%{Volume % 0}%", "0" },
+        { "%Volume%{x}", "5{x}" },
+        { "a%{Volume}%b%Volume%", "a5b5" },
+    };
+    pfw_check_case_t check = {
+        "expr",
+        "NumericalCriterion Volume : [0,10] = 5\n",
+    };
+    char settings[2048];
+    pfw_check_log_t log = { 0 };
+    pfw_system_t* system;
+    int i, n, depth, failed = 0;
+
+    n = snprintf(settings, sizeof(settings), "domain: Expr\n\tconf: any\n"
+                                             "\t\tALL\n");
+    for (i = 0; i < (int)(sizeof(acts) / sizeof(acts[0])); i++)
+        n += snprintf(settings + n, sizeof(settings) - n, "\t\tSet = %s\n",
+            acts[i][0]);
+
+    check.settings = settings;
+    system = pfw_check_logged(&check, &log);
+    if (!system)
+        return 1;
+
+    pfw_apply(system);
+    for (i = 0; i < (int)(sizeof(acts) / sizeof(acts[0])) && !failed; i++) {
+        failed = i >= log.nb || strcmp(log.entries[i], acts[i][1]);
+        if (failed)
+            printf("%s: '%s' renders '%s', expected '%s'\n", check.name,
+                acts[i][0], i < log.nb ? log.entries[i] : "nothing",
+                acts[i][1]);
+    }
+
+    pfw_destroy(system, NULL);
+
+    /* 1 + (1 + (... + 1)) needs a stack slot per operand. */
+
+    for (depth = PFW_CHECK_EXPR_DEPTH; depth <= PFW_CHECK_EXPR_DEPTH + 1
+         && !failed;
+         depth++) {
+        n = snprintf(settings, sizeof(settings), "domain: Expr\n"
+                                                 "\tconf: any\n\t\tALL\n"
+                                                 "\t\tSet = %%{");
+        for (i = 1; i < depth; i++)
+            n += snprintf(settings + n, sizeof(settings) - n, "1 + (");
+
+        n += snprintf(settings + n, sizeof(settings) - n, "1");
+        for (i = 1; i < depth; i++)
+            n += snprintf(settings + n, sizeof(settings) - n, ")");
+
+        snprintf(settings + n, sizeof(settings) - n, "}%%\n");
+        if (!pfw_check_write(PFW_CHECK_CRITERIA, check.criteria)
+            || !pfw_check_write(PFW_CHECK_SETTINGS, settings)) {
+            printf("%s: write failed\n", check.name);
+            return 1;
+        }
+
+        system = pfw_check_reference(PFW_CHECK_CRITERIA, PFW_CHECK_SETTINGS);
+        failed = !system != (depth > PFW_CHECK_EXPR_DEPTH);
+        if (failed)
+            printf("%s: depth %d %s\n", check.name, depth,
+                system ? "loaded" : "refused");
+
+        pfw_destroy(system, NULL);
+    }
+
+    return failed;
+}
+
+/**
+ * @brief Gated domains keep their config while the gate, a parent config
+ * or rules, is closed, and catch up on what changed once it opens.
+ */
+static int pfw_check_gates(void)
+{
+    static const pfw_check_case_t check = {
+        "gates",
+        "ExclusiveCriterion Mode : off on = off\n"
+        "NumericalCriterion Volume : [0,10] = 5\n",
+        "domain: Parent\n"
+        "\tconf: open\n"
+        "\t\tMode Is on\n"
+        "\t\tSet = parent open\n"
+        "\tconf: closed\n"
+        "\t\tALL\n"
+        "\t\tSet = parent closed\n"
+        "domain: Child\n"
+        "\tgate: Parent open\n"
+        "\tconf: loud\n"
+        "\t\tVolume In [6,10]\n"
+        "\t\tSet = child loud\n"
+        "\tconf: quiet\n"
+        "\t\tALL\n"
+        "\t\tSet = child quiet\n"
+        "domain: Ruled\n"
+        "\tgate:\n"
+        "\t\tMode Is on\n"
+        "\tconf: loud\n"
+        "\t\tVolume In [6,10]\n"
+        "\t\tSet = ruled loud\n"
+        "\tconf: quiet\n"
+        "\t\tALL\n"
+        "\t\tSet = ruled quiet\n",
+    };
+    static const struct {
+        const char* mode;
+        int volume;
+        const char* acts;
+    } steps[] = {
+        { "off", 5, "parent closed" },
+        { "off", 8, "" }, /* Dirtied while closed. */
+        { "on", 8, "parent open|child loud|ruled loud" },
+        { "on", 2, "child quiet|ruled quiet" },
+        { "off", 8, "parent closed" },
+        { "on", 8, "parent open|child loud|ruled loud" },
+    };
+    pfw_check_log_t log = { 0 };
+    char acts[PFW_CHECK_MAXLEN_JOINED];
+    void* system;
+    int i, failed = 0;
+
+    system = pfw_check_logged(&check, &log);
+    if (!system)
+        return 1;
+
+    for (i = 0; i < (int)(sizeof(steps) / sizeof(steps[0])) && !failed; i++) {
+        pfw_setstring(system, "Mode", steps[i].mode);
+        pfw_setint(system, "Volume", steps[i].volume);
+        pfw_apply(system);
+
+        pfw_check_join(&log, acts);
+        failed = strcmp(acts, steps[i].acts) != 0;
+        if (failed)
+            printf("%s: step %d delivers '%s', expected '%s'\n", check.name,
+                i, acts, steps[i].acts);
+    }
+
+    pfw_destroy(system, NULL);
+    return failed;
+}
+
+/**
+ * @brief Domains are applied by priority, and pfw_apply_priority() leaves
+ * lower ones dirty until the next pfw_apply().
+ */
+static int pfw_check_priority(void)
+{
+    static const pfw_check_case_t check = {
+        "priority",
+        "NumericalCriterion Volume : [0,10] = 5\n",
+        "domain: Low\n"
+        "\tconf: loud\n"
+        "\t\tVolume In [6,10]\n"
+        "\t\tSet = low loud\n"
+        "\tconf: quiet\n"
+        "\t\tALL\n"
+        "\t\tSet = low quiet\n"
+        "domain: High\n"
+        "\tpriority: 10\n"
+        "\tconf: loud\n"
+        "\t\tVolume In [6,10]\n"
+        "\t\tSet = high loud\n"
+        "\tconf: quiet\n"
+        "\t\tALL\n"
+        "\t\tSet = high quiet\n"
+        "domain: Mid\n"
+        "\tpriority: 5\n"
+        "\tconf: loud\n"
+        "\t\tVolume In [6,10]\n"
+        "\t\tSet = mid loud\n"
+        "\tconf: quiet\n"
+        "\t\tALL\n"
+        "\t\tSet = mid quiet\n",
+    };
+
+    /* Priority -1 stands for a plain pfw_apply(). */
+
+    static const struct {
+        int volume;
+        int priority;
+        const char* acts;
+    } steps[] = {
+        { 5, -1, "high quiet|mid quiet|low quiet" },
+        { 8, 5, "high loud|mid loud" },
+        { 8, 5, "" },
+        { 8, -1, "low loud" },
+        { 2, 10, "high quiet" },
+        { 2, -1, "mid quiet|low quiet" },
+    };
+    pfw_check_log_t log = { 0 };
+    char acts[PFW_CHECK_MAXLEN_JOINED];
+    void* system;
+    int i, failed = 0;
+
+    system = pfw_check_logged(&check, &log);
+    if (!system)
+        return 1;
+
+    for (i = 0; i < (int)(sizeof(steps) / sizeof(steps[0])) && !failed; i++) {
+        pfw_setint(system, "Volume", steps[i].volume);
+        if (steps[i].priority < 0)
+            pfw_apply(system);
+        else
+            pfw_apply_priority(system, steps[i].priority);
+
+        pfw_check_join(&log, acts);
+        failed = strcmp(acts, steps[i].acts) != 0;
+        if (failed)
+            printf("%s: step %d delivers '%s', expected '%s'\n", check.name,
+                i, acts, steps[i].acts);
+    }
+
+    pfw_destroy(system, NULL);
+    return failed;
+}
+
+static void pfw_check_snapshot(pfw_system_t* system,
+    pfw_check_snapshot_t* snapshot)
+{
+    pfw_criterion_t* criterion;
+    pfw_domain_t* domain;
+    int i;
+
+    memset(snapshot, 0, sizeof(pfw_check_snapshot_t));
+    for (i = 0; (criterion = pfw_vector_get(system->criteria, i))
+         && i < PFW_CHECK_MAX_STATES;
+         i++)
+        snapshot->states[i] = criterion->state;
+
+    for (i = 0; (domain = pfw_vector_get(system->domains, i))
+         && i < PFW_CHECK_MAX_STATES;
+         i++)
+        snapshot->dirty[i] = domain->dirty;
+
+    snapshot->system_dirty = system->dirty;
+}
+
+/**
+ * @brief Join "domain:config" of the current config of every domain.
+ */
+static void pfw_check_current(pfw_system_t* system, char* joined)
+{
+    pfw_check_log_t log = { 0 };
+    pfw_domain_t* domain;
+    int i;
+
+    for (i = 0; (domain = pfw_vector_get(system->domains, i)); i++)
+        pfw_check_record_preview(&log, domain->name,
+            domain->current ? domain->current->current : NULL, NULL, NULL);
+
+    pfw_check_join(&log, joined);
+}
+
+/**
+ * @brief pfw_preview() reports the configs that setting the overrides and
+ * applying selects, leaving criteria, derived criteria and dirty flags as
+ * they were, even when it refuses an override.
+ */
+static int pfw_check_preview(void)
+{
+    static const pfw_check_case_t check = {
+        "preview",
+        "ExclusiveCriterion Mode : off on = off\n"
+        "InclusiveCriterion Devices : mic sco = mic\n"
+        "NumericalCriterion Volume : [0,10] = 5\n"
+        "DerivedCriterion Gain : [0,100] = Volume * 10\n",
+        "condition: Loud\n"
+        "\tGain In [60,100]\n"
+        "domain: Mode\n"
+        "\tconf: on\n"
+        "\t\tMode Is on\n"
+        "\t\tSet = mode on\n"
+        "\tconf: off\n"
+        "\t\tALL\n"
+        "\t\tSet = mode off\n"
+        "domain: Sco\n"
+        "\tgate: Mode on\n"
+        "\tconf: sco\n"
+        "\t\tDevices Includes sco\n"
+        "\t\tSet = sco %Volume%\n"
+        "\tconf: none\n"
+        "\t\tALL\n"
+        "\t\tSet = none\n"
+        "domain: Gain\n"
+        "\tconf: loud\n"
+        "\t\tCOND Loud\n"
+        "\t\tSet = loud %Gain%\n"
+        "\tconf: quiet\n"
+        "\t\tALL\n"
+        "\t\tSet = quiet\n",
+    };
+
+    /* Invalid overrides come after a valid one, ret is what preview
+     * returns, 0 if setting them and applying must select its configs.
+     */
+
+    static const struct {
+        pfw_override_t overrides[PFW_CHECK_MAX_OVERRIDES];
+        int nb;
+        int ret;
+    } steps[] = {
+        { { { "Mode", "on" }, { "Devices", "+sco" }, { "Volume", "8" } },
+            3, 0 },
+        { { { "Volume", "2" }, { "Devices", "-sco" } }, 2, 0 },
+        { { { "Mode", "off" }, { "Volume", "9" } }, 2, 0 },
+        { { { "Devices", "+sco" }, { "Mode", "on" } }, 2, 0 },
+        { { { "Volume", "3" }, { "Volume", "7" } }, 2, 0 },
+        { { { "Mode", "off" }, { "Volume", "11" }, { "Devices", "-sco" } },
+            3, -EINVAL },
+        { { { "Mode", "off" }, { "Devices", "+usb" } }, 2, -EINVAL },
+        { { { "Mode", "off" }, { "Gain", "50" } }, 2, -EPERM },
+    };
+    pfw_check_snapshot_t before, after;
+    char preview[PFW_CHECK_MAXLEN_JOINED], current[PFW_CHECK_MAXLEN_JOINED];
+    pfw_check_log_t log = { 0 }, acts = { 0 };
+    const pfw_override_t* override;
+    pfw_system_t* system;
+    int i, j, ret, failed = 0;
+
+    system = pfw_check_logged(&check, &acts);
+    if (!system)
+        return 1;
+
+    pfw_apply(system);
+
+    for (i = 0; i < (int)(sizeof(steps) / sizeof(steps[0])) && !failed; i++) {
+
+        /* Odd steps preview with domains left dirty. */
+
+        if (i % 2)
+            pfw_setint(system, "Volume", i);
+
+        pfw_check_snapshot(system, &before);
+        ret = pfw_preview(system, steps[i].overrides, steps[i].nb,
+            pfw_check_record_preview, &log);
+        pfw_check_snapshot(system, &after);
+        pfw_check_join(&log, preview);
+
+        failed = ret != steps[i].ret
+            || memcmp(&before, &after, sizeof(before));
+        if (failed) {
+            printf("%s: step %d returns %d, expected %d, %s\n", check.name,
+                i, ret, steps[i].ret,
+                memcmp(&before, &after, sizeof(before)) ? "changed states"
+                                                        : "same states");
+            break;
+        }
+
+        if (ret < 0) {
+            failed = preview[0] != '\0';
+            if (failed)
+                printf("%s: step %d refused but reported '%s'\n",
+                    check.name, i, preview);
+
+            continue;
+        }
+
+        for (j = 0; j < steps[i].nb; j++) {
+            override = &steps[i].overrides[j];
+            if (override->value[0] == '+')
+                pfw_include(system, override->name, override->value + 1);
+            else if (override->value[0] == '-')
+                pfw_exclude(system, override->name, override->value + 1);
+            else
+                pfw_setstring(system, override->name, override->value);
+        }
+
+        pfw_apply(system);
+        pfw_check_current(system, current);
+        failed = strcmp(preview, current) != 0;
+        if (failed)
+            printf("%s: step %d previews '%s', applies '%s'\n", check.name,
+                i, preview, current);
+    }
+
+    pfw_destroy(system, NULL);
+    return failed;
+}
+
+/**
+ * @brief PFW_PLUGIN_SKIP_SAME drops calls repeating the last params,
+ * memoized ones by address or not, and delivers changed ones.
+ */
+static int pfw_check_skip_same(void)
+{
+    static const pfw_check_case_t check = {
+        "skip-same",
+        "NumericalCriterion Volume : [0,10] = 5\n"
+        "ExclusiveCriterion Mode : off on = off\n"
+        "NumericalCriterion Band : [0,1000] = 0\n",
+        "domain: Memo\n"
+        "\tconf: high-%Mode%\n"
+        "\t\tVolume In [6,10]\n"
+        "\t\tSet = level %Mode%\n"
+        "\tconf: mid-%Mode%\n"
+        "\t\tVolume In [3,5]\n"
+        "\t\tSet = level %Mode%\n"
+        "\tconf: low\n"
+        "\t\tALL\n"
+        "\t\tFFmpegCommand = low\n"
+        "domain: Fresh\n"
+        "\tconf: high-%Mode%-%Band%\n"
+        "\t\tVolume In [6,10]\n"
+        "\t\tSetParameter = %Mode%-%Band%\n"
+        "\tconf: low-%Mode%-%Band%\n"
+        "\t\tALL\n"
+        "\t\tSetParameter = %Mode%-%Band%\n",
+    };
+
+    /* Memo params render from one small criterion and are memoized,
+     * Fresh ones from two and are rendered on each apply. Config names
+     * follow the params, so changing them applies the config again.
+     */
+
+    static const struct {
+        int volume;
+        const char* mode;
+        int band;
+        const char* acts[2];
+    } steps[] = {
+        { 5, "off", 0, { "level off", "off-0" } },
+        { 8, "off", 0, { "", "" } }, /* Same string, other config. */
+        { 1, "off", 0, { "", "" } },
+        { 4, "off", 0, { "", "" } }, /* Same memoized string. */
+        { 4, "on", 0, { "level on", "on-0" } },
+        { 4, "on", 7, { "", "on-7" } },
+        { 8, "on", 7, { "", "" } },
+    };
+    pfw_check_log_t logs[2] = { 0 };
+    pfw_plugin_def_t defs[3] = {
+        { "Set", &logs[0], pfw_check_record, NULL, PFW_PLUGIN_SKIP_SAME },
+        { "SetParameter", &logs[1], pfw_check_record, NULL,
+            PFW_PLUGIN_SKIP_SAME },
+        { "FFmpegCommand", NULL, pfw_check_callback },
+    };
+    char acts[PFW_CHECK_MAXLEN_JOINED];
+    void* system;
+    int i, j, failed = 0;
+
+    if (!pfw_check_write(PFW_CHECK_CRITERIA, check.criteria)
+        || !pfw_check_write(PFW_CHECK_SETTINGS, check.settings)) {
+        printf("%s: write failed\n", check.name);
+        return 1;
+    }
+
+    system = pfw_create(PFW_CHECK_CRITERIA, PFW_CHECK_SETTINGS, defs, 3,
+        NULL, NULL, NULL);
+    if (!system) {
+        printf("%s: create failed\n", check.name);
+        return 1;
+    }
+
+    for (i = 0; i < (int)(sizeof(steps) / sizeof(steps[0])) && !failed; i++) {
+        pfw_setint(system, "Volume", steps[i].volume);
+        pfw_setstring(system, "Mode", steps[i].mode);
+        pfw_setint(system, "Band", steps[i].band);
+        pfw_apply(system);
+
+        for (j = 0; j < 2; j++) {
+            pfw_check_join(&logs[j], acts);
+            if (!failed && strcmp(acts, steps[i].acts[j])) {
+                printf("%s: step %d delivers '%s' to %s, expected '%s'\n",
+                    check.name, i, acts, defs[j].name, steps[i].acts[j]);
+                failed = 1;
+            }
+        }
+    }
+
+    pfw_destroy(system, NULL);
+    return failed;
+}
+
+/**
+ * @brief pfw_literal() resolves names, '|' masks and numbers to states,
+ * and refuses the others without writing the state.
+ */
+static int pfw_check_literal(void)
+{
+    static const pfw_check_case_t check = {
+        "literal",
+        "ExclusiveCriterion Mode : off on = off\n"
+        "InclusiveCriterion Devices : mic sco usb = mic\n"
+        "NumericalCriterion Volume : [0,10] = 5\n",
+        "domain: Literal\n"
+        "\tconf: any\n"
+        "\t\tALL\n"
+        "\t\tSet = %Mode%\n",
+    };
+    static const struct {
+        const char* name;
+        const char* value;
+        int ret;
+        int state;
+    } cases[] = {
+        { "Mode", "off", 0, 0 },
+        { "Mode", "on", 0, 1 },
+        { "Mode", "mic", -EINVAL, 0 },
+        { "Mode", "off|on", -EINVAL, 0 },
+        { "Devices", "sco", 0, 2 },
+        { "Devices", "mic|usb", 0, 5 },
+        { "Devices", "usb|mic|sco", 0, 7 },
+        { "Devices", "<none>", 0, 0 },
+        { "Devices", "mic|bt", -EINVAL, 0 },
+        { "Devices", "on", -EINVAL, 0 },
+        { "Volume", "8", 0, 8 },
+        { "Volume", "-3", 0, -3 },
+        { "Volume", "0x10", 0, 16 },
+        { "Missing", "on", -EINVAL, 0 },
+    };
+    pfw_check_log_t log = { 0 };
+    void* system;
+    int i, ret, state, expect, failed = 0;
+
+    system = pfw_check_logged(&check, &log);
+    if (!system)
+        return 1;
+
+    for (i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])) && !failed; i++) {
+
+        /* Refused literals leave state as it was. */
+
+        state = -1;
+        ret = pfw_literal(system, pfw_lookup(system, cases[i].name),
+            cases[i].value, &state);
+        expect = cases[i].ret < 0 ? -1 : cases[i].state;
+        failed = ret != cases[i].ret || state != expect;
+        if (failed)
+            printf("%s: %s '%s' returns %d state %d, expected %d state %d\n",
+                check.name, cases[i].name, cases[i].value, ret, state,
+                cases[i].ret, expect);
+    }
+
+    pfw_destroy(system, NULL);
+    return failed;
+}
+
+/**
+ * @brief Whether dedup holds the entries of plain without repeats, in
+ * first occurrence order.
+ */
+static bool pfw_check_unique(pfw_check_log_t* plain, pfw_check_log_t* dedup)
+{
+    int i, j, nb = 0;
+
+    for (i = 0; i < plain->nb; i++) {
+        for (j = 0; j < i && strcmp(plain->entries[j], plain->entries[i]);
+             j++)
+            ;
+
+        if (j < i)
+            continue;
+
+        if (nb >= dedup->nb || strcmp(dedup->entries[nb], plain->entries[i]))
+            return false;
+
+        nb++;
+    }
+
+    return nb == dedup->nb;
+}
+
+/**
+ * @brief PFW_MODE_DEDUP delivers what a plain apply does, once each, on
+ * every apply entry point.
+ */
+static int pfw_check_dedup(void)
+{
+    static const pfw_check_case_t check = {
+        "dedup",
+        "NumericalCriterion Volume : [0,10] = 5\n",
+        "domain: First\n"
+        "\tconf: low\n"
+        "\t\tVolume In [0,4]\n"
+        "\t\tSet = quiet\n"
+        "\t\tSet = volume %Volume%\n"
+        "\tconf: high\n"
+        "\t\tALL\n"
+        "\t\tSet = loud\n"
+        "\t\tSet = volume %Volume%\n"
+        "domain: Second\n"
+        "\tconf: low\n"
+        "\t\tVolume In [0,4]\n"
+        "\t\tSet = quiet\n"
+        "\tconf: high\n"
+        "\t\tALL\n"
+        "\t\tSet = loud\n",
+    };
+    static const char* const names[] = { "Second", "First" };
+    pfw_check_log_t plain = { 0 }, dedup = { 0 };
+    void *system[2], *handle;
+    int i, step, failed = 0;
+
+    system[0] = pfw_check_logged(&check, &plain);
+    system[1] = pfw_check_logged(&check, &dedup);
+    if (!system[0] || !system[1]) {
+        pfw_destroy(system[0], NULL);
+        pfw_destroy(system[1], NULL);
+        return 1;
+    }
+
+    pfw_setmode(system[1], PFW_MODE_DEDUP);
+
+    for (step = 0; step < 4 && !failed; step++) {
+        for (i = 0; i < 2; i++) {
+            handle = system[i];
+            pfw_setint(handle, "Volume", step % 2 ? 8 : 2);
+            switch (step) {
+            case 0:
+                pfw_apply(handle);
+                break;
+
+            case 1:
+                pfw_apply_domain(handle, "First");
+                break;
+
+            case 2:
+                pfw_apply_group(handle, names, 2);
+                break;
+
+            case 3:
+                pfw_apply_priority(handle, 0);
+                break;
+            }
+        }
+
+        failed = plain.nb == 0 || !pfw_check_unique(&plain, &dedup);
+        if (failed)
+            printf("%s: step %d delivers %d acts, %d without dedup\n",
+                check.name, step, dedup.nb, plain.nb);
+
+        plain.nb = dedup.nb = 0;
+    }
+
+    pfw_destroy(system[0], NULL);
+    pfw_destroy(system[1], NULL);
+    return failed;
+}
+
+/**
+ * @brief PFW_MODE_DEDUP keeps the same param of different plugins apart,
+ * and still drops repeats past the size of its first index.
+ */
+static int pfw_check_dedup_plugins(void)
+{
+    static const pfw_check_case_t check = {
+        "dedup-plugins",
+        "NumericalCriterion Volume : [0,10] = 5\n",
+        "domain: First\n"
+        "\tconf: all\n"
+        "\t\tALL\n"
+        "\t\tSet = a\n"
+        "\t\tSet = b\n"
+        "\t\tSet = c\n"
+        "\t\tSet = d\n"
+        "\t\tSet = e\n"
+        "\t\tSet = f\n"
+        "\t\tSetParameter = a\n"
+        "domain: Second\n"
+        "\tconf: all\n"
+        "\t\tALL\n"
+        "\t\tSetParameter = a\n"
+        "\t\tSet = f\n"
+        "\t\tSet = a\n"
+        "\t\tSet = g\n",
+    };
+    static const char* const expect[2] = { "abcdefg", "a" };
+    pfw_check_log_t logs[2] = { 0 };
+    pfw_plugin_def_t defs[2] = {
+        { "Set", &logs[0], pfw_check_record },
+        { "SetParameter", &logs[1], pfw_check_record },
+    };
+    char got[PFW_CHECK_MAX_LOG + 1];
+    void* system;
+    int i, j, failed = 0;
+
+    if (!pfw_check_write(PFW_CHECK_CRITERIA, check.criteria)
+        || !pfw_check_write(PFW_CHECK_SETTINGS, check.settings)) {
+        printf("%s: write failed\n", check.name);
+        return 1;
+    }
+
+    system = pfw_create(PFW_CHECK_CRITERIA, PFW_CHECK_SETTINGS, defs, 2,
+        NULL, NULL, NULL);
+    if (!system) {
+        printf("%s: create failed\n", check.name);
+        return 1;
+    }
+
+    pfw_setmode(system, PFW_MODE_DEDUP);
+    pfw_apply(system);
+
+    for (i = 0; i < 2; i++) {
+        for (j = 0; j < logs[i].nb; j++)
+            got[j] = logs[i].entries[j][0];
+
+        got[j] = '\0';
+        if (strcmp(got, expect[i])) {
+            printf("%s: %s delivers %s, expected %s\n", check.name,
+                defs[i].name, got, expect[i]);
+            failed = 1;
+        }
+    }
+
+    pfw_destroy(system, NULL);
+    return failed;
+}
+
+/**
+ * @brief Whether fields joined back match params, but for a trailing ';'.
+ */
+static bool pfw_check_fields(const char* params, const char* joined)
+{
+    size_t len = strlen(params);
+
+    if (len && params[len - 1] == ';')
+        len--;
+
+    return strlen(joined) == len && !strncmp(params, joined, len);
+}
+
+/**
+ * @brief Plugin with argv callback receives the fields of what a string
+ * callback does, with integers and whole NumericalCriterion typed.
+ */
+static int pfw_check_argv(void)
+{
+    static const char* const expect[] = {
+        "SelSCO,map,#-1",
+        "volume,#0,music;mute,off",
+    };
+    pfw_check_log_t plain = { 0 }, logs[2] = { 0 };
+    pfw_plugin_def_t defs[2] = {
+        { "CommandArgv", &plain, pfw_check_record },
+        { "CommandArgv", logs, NULL, pfw_check_record_argv },
+    };
+    void* system[2];
+    int i, j, step, failed = 0;
+
+    for (i = 0; i < 2; i++) {
+        system[i] = pfw_create("./criteria.txt", "./argv.pfw", &defs[i], 1,
+            NULL, NULL, NULL);
+        if (!system[i]) {
+            printf("argv: create failed\n");
+            pfw_destroy(system[0], NULL);
+            return 1;
+        }
+    }
+
+    for (step = 0; step < 16 && !failed; step++) {
+        for (i = 0; i < 2; i++) {
+            pfw_setstring(system[i], "AudioMode",
+                step & 1 ? "ringtone" : "normal");
+            (step & 2 ? pfw_include : pfw_exclude)(system[i],
+                "AvailableDevices", "sco");
+            pfw_setint(system[i], "HFPSampleRate", step & 4 ? 16000 : 8000);
+            pfw_setstring(system[i], "MuteMode", step & 8 ? "on" : "off");
+            pfw_setint(system[i], "MusicVolume", step % 11);
+            pfw_setint(system[i], "RingVolume", 10 - step % 11);
+            pfw_apply(system[i]);
+        }
+
+        failed = plain.nb != logs[0].nb;
+        if (failed)
+            printf("argv: step %d delivers %d acts, expected %d\n", step,
+                logs[0].nb, plain.nb);
+
+        for (j = 0; j < plain.nb && !failed; j++) {
+            failed = !pfw_check_fields(plain.entries[j], logs[0].entries[j]);
+            if (failed)
+                printf("argv: step %d delivers '%s', expected '%s'\n", step,
+                    logs[0].entries[j], plain.entries[j]);
+        }
+
+        /* First apply runs on the initial states. */
+
+        for (j = 0; step == 0 && j < 2 && !failed; j++) {
+            failed = j >= logs[1].nb || strcmp(logs[1].entries[j], expect[j]);
+            if (failed)
+                printf("argv: typed '%s', expected '%s'\n",
+                    j < logs[1].nb ? logs[1].entries[j] : "nothing",
+                    expect[j]);
+        }
+
+        plain.nb = logs[0].nb = logs[1].nb = 0;
+    }
+
+    pfw_destroy(system[0], NULL);
+    pfw_destroy(system[1], NULL);
+    return failed;
+}
+
+/**
+ * @brief Apply handle the way of check, the plain way if NULL.
+ */
+static void pfw_check_apply(void* handle, const pfw_check_apply_t* check)
+{
+    int cursor = 0;
+
+    if (!check || check->budget == 0) {
+        pfw_apply(handle);
+        return;
+    }
+
+    do {
+        cursor = pfw_apply_budget(handle, cursor, check->budget, 0);
+    } while (cursor > 0);
+}
+
+/**
+ * @brief Every way of applying delivers the same acts as a plain apply,
+ * in the same order, while criteria of the folder's files change.
+ */
+static int pfw_check_applies(void)
+{
+    pfw_check_log_t logs[PFW_CHECK_NB_APPLIES + 1] = { 0 };
+    void* systems[PFW_CHECK_NB_APPLIES + 1] = { 0 };
+    pfw_check_values_t* values;
+    pfw_criterion_t* criterion;
+    pfw_system_t* plain;
+    int i, j, nb, round, index, failed = 0;
+    uint32_t seed = 1;
+
+    for (i = 0; i <= PFW_CHECK_NB_APPLIES && !failed; i++) {
+        systems[i] = pfw_check_open("applies", "./criteria.txt",
+            "./settings.pfw", &logs[i]);
+        failed = !systems[i];
+        if (i > 0 && !failed) {
+            pfw_setmode(systems[i], g_pfw_check_applies[i - 1].mode);
+            failed = pfw_set_workers(systems[i],
+                         g_pfw_check_applies[i - 1].workers)
+                < 0;
+        }
+    }
+
+    plain = systems[0];
+    nb = plain ? pfw_vector_count(plain->criteria) : 0;
+    values = calloc(nb ? nb : 1, sizeof(pfw_check_values_t));
+    if (!values)
+        failed = 1;
+
+    for (i = 0; !failed && (criterion = pfw_vector_get(plain->criteria, i));
+         i++) {
+        if (!criterion->formula)
+            pfw_check_values(plain, criterion, &values[i]);
+    }
+
+    for (round = 0; round < PFW_CHECK_APPLY_ROUNDS && !failed; round++) {
+        /* Change a few criteria at once, so several domains are dirty. */
+
+        for (j = round % 3; j >= 0; j--) {
+            seed = seed * 1103515245u + 12345u;
+            index = (seed >> 16) % nb;
+            if (values[index].nb == 0)
+                continue;
+
+            seed = seed * 1103515245u + 12345u;
+            for (i = 0; i <= PFW_CHECK_NB_APPLIES; i++)
+                pfw_setint_ref(systems[i],
+                    pfw_vector_get(((pfw_system_t*)systems[i])->criteria, index),
+                    values[index].v[(seed >> 16) % values[index].nb]);
+        }
+
+        for (i = 0; i <= PFW_CHECK_NB_APPLIES; i++)
+            pfw_check_apply(systems[i],
+                i > 0 ? &g_pfw_check_applies[i - 1] : NULL);
+
+        for (i = 1; i <= PFW_CHECK_NB_APPLIES && !failed; i++) {
+            failed = logs[i].nb != logs[0].nb;
+            for (j = 0; j < logs[0].nb && !failed; j++)
+                failed = strcmp(logs[i].entries[j], logs[0].entries[j]) != 0;
+
+            if (failed)
+                printf("applies: %s differs from plain apply at round %d\n",
+                    g_pfw_check_applies[i - 1].name, round);
+        }
+
+        for (i = 0; i <= PFW_CHECK_NB_APPLIES; i++)
+            logs[i].nb = 0;
+    }
+
+    free(values);
+    for (i = 0; i <= PFW_CHECK_NB_APPLIES; i++)
+        pfw_destroy(systems[i], NULL);
+
+    return failed;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+int main(int argc, char* argv[])
+{
+    int i, failed = 0, nb = 0;
+
+    /* Keep reports when a sanitizer aborts later. */
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    failed += !!pfw_check_files("settings.pfw", "./criteria.txt",
+        "./settings.pfw");
+    failed += !!pfw_check_files("conditions.pfw", "./criteria.txt",
+        "./conditions.pfw");
+    failed += !!pfw_check_files("argv.pfw", "./criteria.txt", "./argv.pfw");
+    nb += 3;
+
+    for (i = 0; i < (int)(sizeof(g_pfw_check_cases)
+                        / sizeof(g_pfw_check_cases[0]));
+         i++, nb++)
+        failed += !!pfw_check_case(&g_pfw_check_cases[i]);
+
+    for (i = 0; i < (int)(sizeof(g_pfw_check_rejects)
+                        / sizeof(g_pfw_check_rejects[0]));
+         i++, nb++)
+        failed += !!pfw_check_reject(&g_pfw_check_rejects[i]);
+
+    failed += !!pfw_check_wide();
+    failed += !!pfw_check_range();
+    failed += !!pfw_check_derived();
+    failed += !!pfw_check_modulo();
+    failed += !!pfw_check_expr();
+    failed += !!pfw_check_gates();
+    failed += !!pfw_check_priority();
+    failed += !!pfw_check_preview();
+    failed += !!pfw_check_skip_same();
+    failed += !!pfw_check_literal();
+    failed += !!pfw_check_dedup();
+    failed += !!pfw_check_dedup_plugins();
+    failed += !!pfw_check_argv();
+    failed += !!pfw_check_applies();
+    nb += 14;
+
+    remove(PFW_CHECK_CRITERIA);
+    remove(PFW_CHECK_SETTINGS);
+
+    printf("%d of %d checks failed\n", failed, nb);
+    return failed != 0;
+}
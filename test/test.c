@@ -24,6 +24,7 @@
 
 #include "pfw.h"
 #include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -54,13 +55,41 @@ static void pfw_set_parameter_callback(void* cookie, const char* params)
     printf("[%s] id:%d params:%s\n", __func__, (int)(intptr_t)cookie, params);
 }
 
+static void pfw_command_argv_callback(void* cookie,
+    const pfw_command_t* commands, int nb)
+{
+    int i, j;
+
+    printf("[%s] id:%d", __func__, (int)(intptr_t)cookie);
+    for (i = 0; i < nb; i++) {
+        printf(" {");
+        for (j = 0; j < commands[i].argc; j++) {
+            if (commands[i].argv[j].is_int)
+                printf(" #%" PRId32, commands[i].argv[j].value);
+            else
+                printf(" '%s'", commands[i].argv[j].str);
+        }
+        printf(" }");
+    }
+    printf("\n");
+}
+
+static void pfw_preview_callback(void* cookie, const char* domain,
+    const char* config, const char* plugin, const char* params)
+{
+    printf("[%s] %s:%s %s %s\n", __func__, domain, config ? config : "",
+        plugin ? plugin : "", params ? params : "");
+}
+
 /****************************************************************************
  * Private Data
  ****************************************************************************/
 
 static pfw_plugin_def_t plugins[] = {
     { "FFmpegCommand", NULL, pfw_ffmpeg_command_callback },
-    { "SetParameter", NULL, pfw_set_parameter_callback }
+    { "SetParameter", NULL, pfw_set_parameter_callback },
+    { "CommandArgv", NULL, NULL, pfw_command_argv_callback,
+        PFW_PLUGIN_SKIP_SAME }
 };
 
 static int nb_plugins = sizeof(plugins) / sizeof(plugins[0]);
@@ -130,6 +159,22 @@ int main(int argc, char* argv[])
             } 
         } else if (!strcmp(cmd, "apply")) {
             pfw_apply(handle);
+        } else if (!strcmp(cmd, "applydomain")) {
+            ret = pfw_apply_domain(handle, arg1);
+        } else if (!strcmp(cmd, "applypriority")) {
+            pfw_apply_priority(handle, strtol(arg1, NULL, 0));
+        } else if (!strcmp(cmd, "budget")) {
+            do {
+                ret = pfw_apply_budget(handle, ret, strtol(arg1, NULL, 0), 0);
+                printf("cursor %d\n", ret);
+            } while (ret > 0);
+        } else if (!strcmp(cmd, "workers")) {
+            ret = pfw_set_workers(handle, strtol(arg1, NULL, 0));
+        } else if (!strcmp(cmd, "mode")) {
+            ret = pfw_setmode(handle, strtol(arg1, NULL, 0));
+        } else if (!strcmp(cmd, "preview")) {
+            ret = pfw_preview(handle, &(pfw_override_t) { arg1, arg2 },
+                arg1 ? 1 : 0, pfw_preview_callback, NULL);
         } else if (!strcmp(cmd, "dump")) {
             dump = pfw_dump(handle);
             printf("\n%s\n", dump);
@@ -146,6 +191,19 @@ int main(int argc, char* argv[])
             ret = pfw_increase(handle, arg1);
         } else if (!strcmp(cmd, "decrease")) {
             ret = pfw_decrease(handle, arg1);
+        } else if (!strcmp(cmd, "literal")) {
+            ret = pfw_literal(handle, pfw_lookup(handle, arg1), arg2, &res);
+            if (ret >= 0)
+                printf("literal %d\n", res);
+        } else if (!strcmp(cmd, "setintref")) {
+            ret = pfw_setint_ref(handle, pfw_lookup(handle, arg1),
+                strtol(arg2, NULL, 0));
+        } else if (!strcmp(cmd, "includeref")) {
+            ret = pfw_include_ref(handle, pfw_lookup(handle, arg1),
+                strtol(arg2, NULL, 0));
+        } else if (!strcmp(cmd, "excluderef")) {
+            ret = pfw_exclude_ref(handle, pfw_lookup(handle, arg1),
+                strtol(arg2, NULL, 0));
         } else if (!strcmp(cmd, "getint")) {
             ret = pfw_getint(handle, arg1, &res);
             if (ret >= 0)
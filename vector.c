@@ -34,7 +34,7 @@
 
 #define PFW_VECTOR_FACTOR 2
 #define PFW_VECTOR_INIT_SIZE 4
-#define PFW_VECTOR_MAX_SIZE 128
+#define PFW_VECTOR_MAX_SIZE 1024
 
 /****************************************************************************
  * Private Types
@@ -87,22 +87,6 @@ static int pfw_vector_grow(pfw_vector_t* vector)
     return vector->size;
 }
 
-static int pfw_vector_shrink(pfw_vector_t* vector)
-{
-    void* tmp;
-
-    if (vector->cnt >= vector->size)
-        return vector->size;
-
-    tmp = realloc(vector->eles, sizeof(void*) * vector->cnt);
-    if (!tmp)
-        return -ENOMEM;
-
-    vector->eles = tmp;
-    vector->size = vector->cnt;
-    return vector->size;
-}
-
 /****************************************************************************
  * Public Functions
  ****************************************************************************/
@@ -133,16 +117,50 @@ int pfw_vector_append(pfw_vector_t** pv, void* obj)
     return 0;
 }
 
+/**
+ * @brief Get element at index.
+ * @note Never reallocates, so workers may read vectors concurrently.
+ */
 void* pfw_vector_get(pfw_vector_t* vector, int index)
 {
     if (!vector || index < 0 || index >= vector->cnt)
         return NULL;
 
-    pfw_vector_shrink(vector);
-
     return vector->eles[index];
 }
 
+/**
+ * @brief Release spare slots of vector once it is complete, like the
+ * parser does for loaded vectors.
+ */
+void pfw_vector_shrink(pfw_vector_t* vector)
+{
+    void* tmp;
+
+    if (!vector || vector->cnt == 0 || vector->cnt >= vector->size)
+        return;
+
+    /* Keep the larger array if realloc fails. */
+
+    tmp = realloc(vector->eles, sizeof(void*) * vector->cnt);
+    if (!tmp)
+        return;
+
+    vector->eles = tmp;
+    vector->size = vector->cnt;
+}
+
+void pfw_vector_set(pfw_vector_t* vector, int index, void* obj)
+{
+    if (vector && index >= 0 && (size_t)index < vector->cnt)
+        vector->eles[index] = obj;
+}
+
+int pfw_vector_count(pfw_vector_t* vector)
+{
+    return vector ? vector->cnt : 0;
+}
+
 void pfw_vector_free(pfw_vector_t* vector)
 {
     if (vector) {